@@ -1,10 +1,27 @@
 # backend/app.py
 import os
-from fastapi import FastAPI, HTTPException, Header, Depends
+import io
+import csv
+import json
+import hashlib
+import hmac
+import math
+import queue
+import threading
+import time
+from collections import OrderedDict
+from contextlib import asynccontextmanager
+from fastapi import FastAPI, HTTPException, Header, Depends, Request, Response
+from starlette.concurrency import run_in_threadpool
+from bson import ObjectId
 from fastapi.middleware.cors import CORSMiddleware
+from fastapi.responses import StreamingResponse
 from pydantic import BaseModel, field_validator
 from pymongo import MongoClient
-from datetime import datetime, timedelta
+from pymongo import UpdateOne
+from pymongo.errors import BulkWriteError
+from datetime import datetime, timedelta, timezone
+from typing import Optional
 import pytz
 from dotenv import load_dotenv
 
@@ -18,6 +35,52 @@ DB_NAME = os.getenv("DB_NAME", "irrigacao_db")
 TIMEZONE_STR = os.getenv("TIMEZONE", "America/Sao_Paulo")
 # Chave API para autenticar o ESP32 (MUDAR NO .env!)
 API_KEY = os.getenv("API_KEY", "minha-chave-secreta-esp32")
+# Registros de firmwares antigos (sem campo "dispositivo") caem neste ID
+DISPOSITIVO_PADRAO = os.getenv("DISPOSITIVO_PADRAO", "esp32")
+# Fila de ingestão: acima de FILA_ALERTA o backend pede Retry-After aos nós;
+# com a fila cheia responde 503.
+FILA_MAX = int(os.getenv("FILA_MAX", "5000"))
+FILA_ALERTA = int(os.getenv("FILA_ALERTA", "500"))
+RETRY_AFTER_MAX_S = int(os.getenv("RETRY_AFTER_MAX_S", "300"))
+LOTE_MAX = 200
+# Atraso máximo aceito no idade_ms dos nós (lotes guardados na fila do firmware)
+IDADE_LOTE_MAX_MS = 86400 * 1000
+# Cache do /historico/grafico: invalidado pela ingestão; o TTL só existe para a
+# janela deslizar (pontos antigos saem) mesmo sem dados novos.
+CACHE_GRAFICO_TTL_S = int(os.getenv("CACHE_GRAFICO_TTL_S", "60"))
+CACHE_GRAFICO_MAX = int(os.getenv("CACHE_GRAFICO_MAX", "64"))   # Entradas (LRU)
+# Limites de horas/limit do gráfico (os do seletor e da página do dashboard):
+# a chave do cache vem do cliente, então não pode variar livremente
+GRAFICO_HORAS_MAX = int(os.getenv("GRAFICO_HORAS_MAX", "72"))
+GRAFICO_LIMITE_MAX = 1000
+# Sem leitura há mais que isso, o nó aparece como offline em /api/umidade/atual
+ONLINE_MAX_S = int(os.getenv("ONLINE_MAX_S", "600"))
+# Exportação: documentos por bloco (também o tamanho do row group no Parquet)
+EXPORT_BLOCO = int(os.getenv("EXPORT_BLOCO", "5000"))
+# Retenção em camadas (dias; 0 = sem expiração): bruto -> agregados por minuto -> por hora.
+# Os índices TTL apagam pelo campo "ts"; a compactação roda antes disso.
+RETENCAO_BRUTO_DIAS = int(os.getenv("RETENCAO_BRUTO_DIAS", "30"))
+RETENCAO_MINUTO_DIAS = int(os.getenv("RETENCAO_MINUTO_DIAS", "180"))
+RETENCAO_HORA_DIAS = int(os.getenv("RETENCAO_HORA_DIAS", "1825"))
+COMPACTACAO_INTERVALO_S = int(os.getenv("COMPACTACAO_INTERVALO_S", "300"))
+COMPACTACAO_ATRASO_S = 120   # Espera a fila gravar as leituras do bucket antes de fechá-lo
+# Janelas maiores que isso (horas) usam os agregados no gráfico
+GRAFICO_MINUTO_A_PARTIR_H = int(os.getenv("GRAFICO_MINUTO_A_PARTIR_H", "48"))
+GRAFICO_HORA_A_PARTIR_H = int(os.getenv("GRAFICO_HORA_A_PARTIR_H", "168"))
+# Alertas: regras em JSON (lista) ou as padrão abaixo; webhook opcional
+ALERTAS_REGRAS = os.getenv("ALERTAS_REGRAS")
+ALERTAS_WEBHOOK_URL = os.getenv("ALERTAS_WEBHOOK_URL")
+# Uplink assinado (HMAC-SHA256 com chave por dispositivo): com ASSINATURA_OBRIGATORIA=1
+# o X-API-Key deixa de valer nos endpoints dos nós; X-Timestamp fora da tolerância é recusado
+ASSINATURA_OBRIGATORIA = os.getenv("ASSINATURA_OBRIGATORIA", "0") == "1"
+ASSINATURA_TOLERANCIA_S = int(os.getenv("ASSINATURA_TOLERANCIA_S", "300"))
+CHAVES_CACHE_TTL_S = 300
+CHAVES_RECARGA_MIN_S = 30   # Assinatura inválida força nova leitura da chave, no máximo nesse ritmo
+JANELA_REPLAY = 64          # Seqs aceitos fora de ordem atrás do maior já visto
+# Auto-ajuste do controle por dispositivo (job incremental sobre o histórico bruto)
+AJUSTE_INTERVALO_S = int(os.getenv("AJUSTE_INTERVALO_S", "900"))
+AJUSTE_LOTE = 5000          # Registros novos lidos por dispositivo a cada passada
+AJUSTE_MEMORIA_DIAS = 7     # Esquecimento exponencial das estatísticas do modelo
 
 # === CONEXÃO COM MONGODB ===
 try:
@@ -31,12 +94,647 @@ except Exception as e:
 
 db = client[DB_NAME]
 hist_col = db["historico_umidade"] # Nova coleção focada apenas na umidade
+capturas_col = db["capturas"] # Capturas rápidas (ADC bruto) em torno de eventos da bomba
+ultima_col = db["ultima_leitura"] # Um documento por dispositivo (_id = dispositivo)
+minuto_col = db["historico_minuto"] # Agregados por minuto (mesmos campos do bruto)
+hora_col = db["historico_hora"]     # Agregados por hora
+compactacao_col = db["compactacao"] # Marcas d'água da compactação (_id = nível)
+chaves_col = db["chaves_dispositivo"] # Chave HMAC por nó (_id = dispositivo, chave em hex)
+ajuste_col = db["ajuste_controle"] # Modelo e parâmetros de controle por nó (_id = dispositivo)
+
+# === FILA DE INGESTÃO ===
+# O POST só valida e enfileira; uma thread grava em lotes (insert_many). A
+# profundidade da fila é a medida de carga usada para o Retry-After.
+fila_ingestao = queue.Queue(maxsize=FILA_MAX)
+
+# === ÚLTIMA LEITURA POR DISPOSITIVO ===
+# Atualizada no POST (antes da fila) e persistida pela thread de gravação, para
+# que "umidade atual" seja uma leitura de dicionário e não uma busca no histórico.
+ultima_leitura = {}
+trava_ultima = threading.Lock()
+
+def registrar_ultima(doc, idade_s=0.0):
+    """Guarda o resumo do doc como estado atual do dispositivo (lotes atrasados mais velhos são ignorados)."""
+    atual = {k: doc[k] for k in ("dispositivo", "timestamp_local", "umidade", "bomba", "display_ok",
+                                 "temperatura_ar", "umidade_ar", "taxa_secagem", "eta_irrigacao_min") if k in doc}
+    atual["recebido_em"] = time.time() - idade_s
+    with trava_ultima:
+        anterior = ultima_leitura.get(doc["dispositivo"])
+        if anterior and anterior["timestamp_local"] > atual["timestamp_local"]:
+            return
+        ultima_leitura[doc["dispositivo"]] = atual
+
+def persistir_ultima(dispositivos):
+    """Grava (upsert) o estado atual dos dispositivos do lote."""
+    with trava_ultima:
+        estados = [dict(ultima_leitura[d]) for d in dispositivos if d in ultima_leitura]
+    for estado in estados:
+        try:
+            ultima_col.replace_one({"_id": estado["dispositivo"]}, estado, upsert=True)
+        except Exception as e:
+            print(f"Erro ao gravar última leitura de {estado['dispositivo']}: {e}")
+
+def carregar_ultima():
+    """Recarrega o estado atual na partida (sobrevive a reinícios do backend)."""
+    try:
+        for estado in ultima_col.find():
+            estado["dispositivo"] = estado.pop("_id")
+            ultima_leitura.setdefault(estado["dispositivo"], estado)
+    except Exception as e:
+        print(f"Erro ao carregar últimas leituras: {e}")
+
+# === ALERTAS ===
+# Avaliados no POST, leitura a leitura, com estado O(1) por (regra, dispositivo):
+#   limite:    campo abaixo/acima de um valor, com histerese para não oscilar
+#   taxa:      variação por hora (medida a cada janela_s) além de max_por_hora
+#   sem_dados: nó calado há mais de timeout_s (verificado por uma thread, usando
+#              ultima_leitura; nenhuma consulta ao banco)
+# Cada transição gera um evento "disparado" ou "resolvido" para os destinos.
+# O tempo é o "ts" do doc (lotes atrasados vêm datados de quando fecharam);
+# docs mais velhos que janela_s não avaliam limite/taxa: é estado passado.
+REGRAS_PADRAO = [
+    {"nome": "solo_seco", "tipo": "limite", "campo": "umidade", "abaixo": 20, "histerese": 3},
+    {"nome": "secagem_rapida", "tipo": "taxa", "campo": "umidade", "max_por_hora": -15},
+    {"nome": "sensor_mudo", "tipo": "sem_dados", "timeout_s": 900},
+]
+JANELA_ALERTA_S = 300
+CAMPOS_REGRA = {
+    "limite": ("campo",),
+    "taxa": ("campo", "max_por_hora"),
+    "sem_dados": ("timeout_s",),
+}
+
+def validar_regras(regras):
+    """Descarta (com aviso) as regras malformadas: uma regra ruim não pode derrubar o POST."""
+    validas = []
+    for regra in regras if isinstance(regras, list) else []:
+        tipo = regra.get("tipo") if isinstance(regra, dict) else None
+        faltando = [c for c in CAMPOS_REGRA.get(tipo, ()) if c not in regra]
+        numeros = [regra[c] for c in ("abaixo", "acima", "histerese", "max_por_hora", "timeout_s", "janela_s")
+                   if isinstance(regra, dict) and c in regra]
+        if (tipo not in CAMPOS_REGRA or not regra.get("nome") or faltando
+                or (tipo == "limite" and ("abaixo" in regra) == ("acima" in regra))
+                or not all(isinstance(v, (int, float)) and not isinstance(v, bool) for v in numeros)
+                or regra.get("janela_s", 1) <= 0):
+            print(f"Regra de alerta inválida ignorada: {regra}")
+            continue
+        validas.append(regra)
+    return validas
+
+try:
+    regras_alerta = validar_regras(json.loads(ALERTAS_REGRAS) if ALERTAS_REGRAS else REGRAS_PADRAO)
+except json.JSONDecodeError as e:
+    print(f"ALERTAS_REGRAS inválido ({e}): usando as regras padrão")
+    regras_alerta = REGRAS_PADRAO
+estado_alerta = {}    # (regra, dispositivo) -> {"ativo", "valor", "t"}
+trava_alerta = threading.Lock()
+fila_alertas = queue.Queue(maxsize=1000)   # Destinos lentos (webhook) não seguram o POST
+destinos_alerta = []
+
+def destino_log(evento):
+    print(f"ALERTA {evento['estado'].upper()}: {evento['regra']} em {evento['dispositivo']} ({evento['detalhe']})")
+
+def destino_webhook(evento):
+    import urllib.request
+    req = urllib.request.Request(ALERTAS_WEBHOOK_URL, data=json.dumps(evento).encode(),
+                                 headers={"Content-Type": "application/json"})
+    urllib.request.urlopen(req, timeout=5).close()
+
+def registrar_destino(fn):
+    """Acrescenta um destino de alertas (função que recebe o evento)."""
+    destinos_alerta.append(fn)
+
+registrar_destino(destino_log)
+if ALERTAS_WEBHOOK_URL:
+    registrar_destino(destino_webhook)
+
+def transicao_alerta(regra, dispositivo, ativo, detalhe):
+    """Atualiza o estado (chamar com trava_alerta) e enfileira o evento se mudou."""
+    chave = (regra["nome"], dispositivo)
+    st = estado_alerta.setdefault(chave, {"ativo": False})
+    if st["ativo"] == ativo:
+        return
+    st["ativo"] = ativo
+    evento = {"regra": regra["nome"], "tipo": regra["tipo"], "dispositivo": dispositivo,
+              "estado": "disparado" if ativo else "resolvido", "detalhe": detalhe, "t": time.time()}
+    try:
+        fila_alertas.put_nowait(evento)
+    except queue.Full:
+        print(f"Fila de alertas cheia, evento descartado: {evento}")
+
+def avaliar_alertas(doc):
+    """Avalia as regras de leitura para um doc recém-ingerido."""
+    disp = doc["dispositivo"]
+    t_doc = doc["ts"].replace(tzinfo=timezone.utc).timestamp()
+    idade = time.time() - t_doc
+    with trava_alerta:
+        for regra in regras_alerta:
+            if regra.get("dispositivo") not in (None, disp):
+                continue
+            tipo = regra["tipo"]
+            if tipo == "sem_dados":
+                transicao_alerta(regra, disp, False, "leitura recebida")
+                continue
+            valor = doc.get(regra["campo"])
+            if valor is None or idade > regra.get("janela_s", JANELA_ALERTA_S):
+                continue
+            if tipo == "limite":
+                h = regra.get("histerese", 0)
+                ativo = estado_alerta.get((regra["nome"], disp), {}).get("ativo", False)
+                if "abaixo" in regra:
+                    ativo = valor < regra["abaixo"] + (h if ativo else 0)
+                else:
+                    ativo = valor > regra["acima"] - (h if ativo else 0)
+                transicao_alerta(regra, disp, ativo, f"{regra['campo']}={valor}")
+            elif tipo == "taxa":
+                # Taxa medida sobre pelo menos janela_s: leituras próximas não viram picos
+                st = estado_alerta.setdefault((regra["nome"], disp), {"ativo": False})
+                if "t" not in st:
+                    st["valor"], st["t"] = valor, t_doc
+                elif t_doc - st["t"] >= regra.get("janela_s", JANELA_ALERTA_S):
+                    por_hora = (valor - st["valor"]) * 3600 / (t_doc - st["t"])
+                    limite = regra["max_por_hora"]
+                    ativo = por_hora < limite if limite < 0 else por_hora > limite
+                    transicao_alerta(regra, disp, ativo, f"{por_hora:.1f} {regra['campo']}/h")
+                    st["valor"], st["t"] = valor, t_doc
+
+def vigia_alertas():
+    """Thread: regras sem_dados sobre ultima_leitura e entrega dos eventos aos destinos."""
+    proxima_varredura = 0.0
+    while True:
+        try:
+            evento = fila_alertas.get(timeout=5)
+            for destino in destinos_alerta:
+                try:
+                    destino(evento)
+                except Exception as e:
+                    print(f"Erro no destino de alerta {destino.__name__}: {e}")
+        except queue.Empty:
+            pass
+        agora = time.time()
+        if agora < proxima_varredura:
+            continue
+        proxima_varredura = agora + 30
+        with trava_ultima:
+            idades = {d: agora - e["recebido_em"] for d, e in ultima_leitura.items() if "recebido_em" in e}
+        with trava_alerta:
+            for regra in regras_alerta:
+                if regra["tipo"] != "sem_dados":
+                    continue
+                for disp, idade in idades.items():
+                    if regra.get("dispositivo") in (None, disp) and idade > regra["timeout_s"]:
+                        transicao_alerta(regra, disp, True, f"sem dados há {int(idade)} s")
+
+def gravar_lote(lote):
+    """Grava um lote com até 3 tentativas. Os _id já vêm do POST, então uma
+    repetição após gravação parcial só gera duplicatas, que são ignoradas.
+    "atualizado" é carimbado aqui, na hora da escrita: o _id é de quando o POST
+    chegou e pode ficar visível depois de _id maiores (cursor do gráfico)."""
+    for tentativa in range(3):
+        for doc in lote:
+            doc["atualizado"] = ObjectId()
+        try:
+            hist_col.insert_many(lote, ordered=False)
+            invalidar_cache_grafico({doc["dispositivo"] for doc in lote})
+            marcar_recompactacao(lote)
+            return
+        except BulkWriteError as e:
+            if all(err.get("code") == 11000 for err in e.details.get("writeErrors", [])):
+                invalidar_cache_grafico({doc["dispositivo"] for doc in lote})
+                marcar_recompactacao(lote)
+                return
+            print(f"Erro ao gravar lote ({len(lote)} docs, tentativa {tentativa + 1}): {e}")
+        except Exception as e:
+            print(f"Erro ao gravar lote ({len(lote)} docs, tentativa {tentativa + 1}): {e}")
+        time.sleep(1)
+    print(f"Lote descartado após 3 tentativas: {len(lote)} registros perdidos.")
+
+# === CACHE DO GRÁFICO (ETag) ===
+# Chave: (dispositivo, horas, limit); dispositivo None = todos. Cada entrada
+# guarda o corpo JSON já serializado e o ETag forte (hash desses bytes), então
+# N painéis abertos custam uma consulta por ingestão, não uma por visitante.
+# LRU de até CACHE_GRAFICO_MAX entradas; a trava da chave sai junto com a entrada.
+cache_grafico = OrderedDict()
+trava_cache = threading.Lock()
+travas_chave = {}   # Uma trava por chave: só um cálculo por vez em cada falta
+
+def invalidar_cache_grafico(dispositivos):
+    """Chamado depois de gravar dados: descarta as entradas dos dispositivos e as de 'todos'."""
+    with trava_cache:
+        for chave in list(cache_grafico):
+            if chave[0] is None or chave[0] in dispositivos:
+                del cache_grafico[chave]
+                travas_chave.pop(chave, None)
+
+def cache_grafico_valido(chave):
+    with trava_cache:
+        entrada = cache_grafico.get(chave)
+        if entrada:
+            cache_grafico.move_to_end(chave)
+    if entrada and time.monotonic() - entrada["criado"] < CACHE_GRAFICO_TTL_S:
+        return entrada
+    return None
+
+def guardar_cache_grafico(chave, entrada):
+    """Insere a entrada e despeja as menos usadas (com as travas delas) acima do limite."""
+    with trava_cache:
+        cache_grafico[chave] = entrada
+        cache_grafico.move_to_end(chave)
+        while len(cache_grafico) > CACHE_GRAFICO_MAX:
+            antiga, _ = cache_grafico.popitem(last=False)
+            travas_chave.pop(antiga, None)
+
+def etag_confere(if_none_match: Optional[str], etag: str) -> bool:
+    """Compara If-None-Match (lista, '*' ou W/) com o ETag atual."""
+    if not if_none_match:
+        return False
+    candidatos = [c.strip() for c in if_none_match.split(",")]
+    return "*" in candidatos or etag in candidatos or f"W/{etag}" in candidatos
+
+# === RETENÇÃO E COMPACTAÇÃO ===
+# Os agregados usam os mesmos nomes de campo do bruto (umidade_media, _min, _max,
+# amostras_intervalo), então o gráfico lê qualquer nível com o mesmo código.
+# "soma" guarda media*n para que a hora seja agregada a partir dos minutos.
+# "atualizado" (ObjectId) muda a cada regravação do bucket: é o cursor de
+# gravação dos agregados, como o carimbo do gravador é o do bruto (busca
+# incremental do gráfico).
+# Lotes atrasados na fila do nó chegam datados de quando foram fechados, muitas
+# vezes em buckets que a compactação já fechou: os minutos deles ficam anotados
+# em compactacao/"pendentes" e são refeitos na passada seguinte.
+
+def agora_utc() -> datetime:
+    """UTC sem tzinfo, como o pymongo devolve datas."""
+    return datetime.now(timezone.utc).replace(tzinfo=None)
+
+def garantir_ttl(col, dias):
+    """Cria (ou ajusta) o índice TTL em "ts"; dias=0 mantém um índice comum."""
+    opcoes = {"expireAfterSeconds": dias * 86400} if dias else {}
+    try:
+        col.create_index("ts", **opcoes)
+    except Exception:
+        # Índice já existe com outro prazo: altera no lugar
+        try:
+            db.command("collMod", col.name, index={"keyPattern": {"ts": 1}, **opcoes})
+        except Exception as e:
+            print(f"Erro ao ajustar TTL de {col.name}: {e}")
+
+def migrar_ts():
+    """Preenche "ts" em registros antigos a partir do _id, para o TTL alcançá-los."""
+    while True:
+        docs = list(hist_col.find({"ts": {"$exists": False}}, {"_id": 1}).limit(1000))
+        if not docs:
+            return
+        hist_col.bulk_write([
+            UpdateOne({"_id": d["_id"]}, {"$set": {"ts": d["_id"].generation_time.replace(tzinfo=None)}})
+            for d in docs
+        ], ordered=False)
+
+def migrar_atualizado(col):
+    """Dá um "atualizado" distinto aos agregados antigos (o cursor não pode ter empates)."""
+    while True:
+        docs = list(col.find({"atualizado": {"$exists": False}}, {"_id": 1}).limit(1000))
+        if not docs:
+            break
+        col.bulk_write([UpdateOne({"_id": d["_id"]}, {"$set": {"atualizado": ObjectId()}}) for d in docs],
+                       ordered=False)
+    col.create_index("atualizado")
+
+def marcar_recompactacao(lote):
+    """Anota os minutos de docs que chegaram depois do atraso da compactação."""
+    limite = agora_utc() - timedelta(seconds=COMPACTACAO_ATRASO_S)
+    minutos = {doc["ts"].replace(second=0, microsecond=0) for doc in lote if doc["ts"] < limite}
+    if not minutos:
+        return
+    try:
+        compactacao_col.update_one({"_id": "pendentes"},
+                                   {"$addToSet": {"minutos": {"$each": sorted(minutos)}}}, upsert=True)
+    except Exception as e:
+        print(f"Erro ao anotar recompactação ({len(minutos)} minutos): {e}")
+
+def inicio_bucket(ts, passo):
+    """Início (UTC) do bucket de minuto ou de hora que contém ts."""
+    ts = ts.replace(second=0, microsecond=0)
+    return ts.replace(minute=0) if passo >= timedelta(hours=1) else ts
+
+def rotulo_local(inicio):
+    """timestamp_local de um bucket: o início UTC no fuso TIMEZONE."""
+    try:
+        tz = pytz.timezone(TIMEZONE_STR)
+    except pytz.exceptions.UnknownTimeZoneError:
+        tz = pytz.utc
+    return pytz.utc.localize(inicio).astimezone(tz).strftime("%Y-%m-%dT%H:%M:%S")
+
+def agregar(origem, inicio, fim, passo):
+    """
+    Agrega docs de origem com ts em [inicio, fim) por dispositivo e bucket UTC.
+    A chave é o ts truncado, não o timestamp_local: com fuso de meia hora ou na
+    hora repetida do fim do horário de verão, um rótulo local cobre duas janelas UTC.
+    """
+    grupos = {}
+    for doc in origem.find({"ts": {"$gte": inicio, "$lt": fim}}):
+        chave = (doc["dispositivo"], inicio_bucket(doc["ts"], passo))
+        n = int(doc.get("amostras_intervalo", 1))
+        media = float(doc.get("umidade_media", doc["umidade"]))
+        g = grupos.get(chave)
+        if g is None:
+            g = grupos[chave] = {"n": 0, "soma": 0.0, "registros": 0, "ts": doc["ts"],
+                                 "min": math.inf, "max": -math.inf, "ultima": doc["umidade"], "ultimo_ts": doc["ts"]}
+        g["n"] += n
+        g["soma"] += float(doc.get("soma", media * n))
+        g["registros"] += int(doc.get("registros", 1))
+        g["min"] = min(g["min"], float(doc.get("umidade_min", doc["umidade"])))
+        g["max"] = max(g["max"], float(doc.get("umidade_max", doc["umidade"])))
+        g["ts"] = min(g["ts"], doc["ts"])
+        if doc["ts"] >= g["ultimo_ts"]:
+            g["ultima"], g["ultimo_ts"] = doc["umidade"], doc["ts"]
+    return grupos
+
+def compactar_nivel(nivel, origem, destino, passo, fim_max):
+    """Fecha os buckets de origem até fim_max em destino; idempotente (_id determinístico)."""
+    marca = compactacao_col.find_one({"_id": nivel})
+    if marca:
+        inicio = marca["ate"]
+    else:
+        primeiro = origem.find_one({"ts": {"$exists": True}}, sort=[("ts", 1)])
+        if primeiro is None:
+            return None
+        inicio = primeiro["ts"].replace(second=0, microsecond=0)
+        if passo >= timedelta(hours=1):
+            inicio = inicio.replace(minute=0)
+    dispositivos = set()
+    while inicio + passo <= fim_max:
+        # Janelas de até 6 h por consulta para limitar memória ao recuperar atrasos
+        fim = min(fim_max, inicio + max(passo, timedelta(hours=6)))
+        fim -= (fim - inicio) % passo
+        dispositivos |= regravar_buckets(origem, destino, inicio, fim, passo)
+        compactacao_col.replace_one({"_id": nivel}, {"_id": nivel, "ate": fim}, upsert=True)
+        inicio = fim
+    if dispositivos:
+        invalidar_cache_grafico(dispositivos)
+    return inicio
+
+def regravar_buckets(origem, destino, inicio, fim, passo):
+    """(Re)escreve em destino os buckets de [inicio, fim); devolve os dispositivos tocados."""
+    ops = []
+    ids = []
+    dispositivos = set()
+    for (disp, bucket), g in agregar(origem, inicio, fim, passo).items():
+        media = g["soma"] / g["n"] if g["n"] else g["ultima"]
+        ids.append(f"{disp}|{bucket:%Y-%m-%dT%H:%M}Z")
+        ops.append(UpdateOne({"_id": ids[-1]}, {"$set": {
+            "dispositivo": disp,
+            "timestamp_local": rotulo_local(bucket),
+            "ts": g["ts"],
+            "umidade": round(media, 2),
+            "umidade_media": round(media, 2),
+            "umidade_min": g["min"],
+            "umidade_max": g["max"],
+            "amostras_intervalo": g["n"],
+            "soma": g["soma"],
+            "registros": g["registros"],
+            "atualizado": ObjectId(),
+        }}, upsert=True))
+        dispositivos.add(disp)
+    if ops:
+        destino.bulk_write(ops, ordered=False)
+    # Buckets da janela que não saíram agora são de antes da chave UTC (rótulo
+    # local no _id): os dados deles acabaram de ser regravados com a chave nova
+    destino.delete_many({"ts": {"$gte": inicio, "$lt": fim}, "_id": {"$nin": ids}})
+    return dispositivos
+
+def recompactar():
+    """Refaz os minutos anotados por lotes atrasados e as horas já fechadas que os contêm."""
+    pendentes = compactacao_col.find_one_and_update({"_id": "pendentes"}, {"$set": {"minutos": []}})
+    minutos = sorted(set((pendentes or {}).get("minutos", [])))
+    if not minutos:
+        return
+    marca_hora = compactacao_col.find_one({"_id": "hora"})
+    horas = set()
+    dispositivos = set()
+    for minuto in minutos:
+        dispositivos |= regravar_buckets(hist_col, minuto_col, minuto, minuto + timedelta(minutes=1),
+                                         timedelta(minutes=1))
+        hora = minuto.replace(minute=0)
+        if marca_hora and hora + timedelta(hours=1) <= marca_hora["ate"]:
+            horas.add(hora)
+    for hora in sorted(horas):
+        dispositivos |= regravar_buckets(minuto_col, hora_col, hora, hora + timedelta(hours=1), timedelta(hours=1))
+    invalidar_cache_grafico(dispositivos)
+    print(f"Recompactação: {len(minutos)} minutos e {len(horas)} horas com dados atrasados")
+
+def compactador():
+    """Thread de compactação: bruto -> minuto -> hora, a cada COMPACTACAO_INTERVALO_S."""
+    try:
+        migrar_ts()
+        migrar_atualizado(minuto_col)
+        migrar_atualizado(hora_col)
+        # Bruto antigo fica sem "atualizado": já estava gravado antes de qualquer cursor
+        hist_col.create_index("atualizado")
+        garantir_ttl(hist_col, RETENCAO_BRUTO_DIAS)
+        garantir_ttl(minuto_col, RETENCAO_MINUTO_DIAS)
+        garantir_ttl(hora_col, RETENCAO_HORA_DIAS)
+    except Exception as e:
+        print(f"Erro ao preparar retenção: {e}")
+    while True:
+        try:
+            limite = agora_utc() - timedelta(seconds=COMPACTACAO_ATRASO_S)
+            limite = limite.replace(second=0, microsecond=0)
+            ate_minuto = compactar_nivel("minuto", hist_col, minuto_col, timedelta(minutes=1), limite)
+            if ate_minuto:
+                # A hora só fecha sobre minutos já compactados
+                compactar_nivel("hora", minuto_col, hora_col, timedelta(hours=1),
+                                ate_minuto.replace(minute=0))
+            recompactar()
+        except Exception as e:
+            print(f"Erro na compactação: {e}")
+        time.sleep(COMPACTACAO_INTERVALO_S)
+
+# === AUTO-AJUSTE DO CONTROLE ===
+# Modelo simples por canteiro a partir dos registros de umidade e do estado da
+# bomba: ganho da rega (%/min de bomba), secagem (%/min), atraso até a água
+# chegar ao sensor, sobressinal depois de desligar e ruído da leitura. As
+# estatísticas são somas com esquecimento exponencial guardadas em
+# ajuste_controle junto com a marca d'água "marca_id" (_id, ordem de inserção):
+# cada passada só lê o que chegou depois dela, inclusive lotes atrasados datados
+# no passado. Os parâmetros vão para o nó na resposta do registro.
+parametros_controle = {}   # dispositivo -> parâmetros publicados (com "versao")
+trava_parametros = threading.Lock()
+
+PULSO_MIN_MS, PULSO_MAX_MS = 3000, 120000
+ANTECIPACAO_MIN, ANTECIPACAO_MAX = 5, 120
+
+def modelo_vazio():
+    return {"rega_du": 0.0, "rega_min": 0.0, "seca_du": 0.0, "seca_min": 0.0,
+            "ruido_var": None, "atraso_min": None, "sobressinal": None,
+            "anterior": None, "rega_inicio": None, "pos_rega": None}
+
+def ewma(atual, valor, alfa=0.2):
+    return valor if atual is None else atual + alfa * (valor - atual)
+
+def atualizar_modelo(m, doc):
+    """Incorpora um registro (em ordem de ts) às estatísticas do modelo."""
+    u = float(doc["umidade"])
+    bomba = bool(doc.get("bomba"))
+    ts = doc["ts"]
+    if doc.get("umidade_desvio") is not None:
+        m["ruido_var"] = ewma(m["ruido_var"], float(doc["umidade_desvio"]) ** 2, 0.05)
+
+    ant = m["anterior"]
+    if ant is not None and ts <= ant["ts"]:
+        return   # Lote atrasado mais velho que o modelo: só o ruído independe da ordem
+    if ant is not None:
+        dt_min = (ts - ant["ts"]).total_seconds() / 60
+        if 0 < dt_min <= 10:   # Lacunas grandes (nó fora) não entram no modelo
+            esquece = math.exp(-dt_min / (AJUSTE_MEMORIA_DIAS * 1440))
+            for k in ("rega_du", "rega_min", "seca_du", "seca_min"):
+                m[k] *= esquece
+            du = u - ant["u"]
+            if ant["bomba"]:
+                m["rega_du"] += du
+                m["rega_min"] += dt_min
+            elif m["pos_rega"] is None:
+                m["seca_du"] += du
+                m["seca_min"] += dt_min
+
+        # Bomba ligou: mede o atraso até a leitura subir acima do ruído
+        if bomba and not ant["bomba"]:
+            m["rega_inicio"] = {"u": ant["u"], "ts": ts}
+        # Bomba desligou: acompanha o pico depois dela (infiltração)
+        if ant["bomba"] and not bomba:
+            m["pos_rega"] = {"u": u, "pico": u, "ts": ts}
+
+    limiar = 2 * math.sqrt(m["ruido_var"] or 0.25)
+    ri = m["rega_inicio"]
+    if ri is not None and u - ri["u"] > limiar:
+        m["atraso_min"] = ewma(m["atraso_min"], (ts - ri["ts"]).total_seconds() / 60)
+        m["rega_inicio"] = None
+    pr = m["pos_rega"]
+    if pr is not None:
+        pr["pico"] = max(pr["pico"], u)
+        if bomba or (ts - pr["ts"]).total_seconds() > 1800:
+            m["sobressinal"] = ewma(m["sobressinal"], pr["pico"] - pr["u"])
+            m["pos_rega"] = None
+    m["anterior"] = {"u": u, "bomba": bomba, "ts": ts}
+
+def parametros_de(m):
+    """Parâmetros do controlador a partir do modelo; None enquanto faltam dados de rega."""
+    if m["rega_min"] < 2 or m["rega_du"] <= 0:
+        return None
+    ganho = m["rega_du"] / m["rega_min"]              # %/min com a bomba ligada
+    ruido = math.sqrt(m["ruido_var"] or 0.25)
+    # Pulso preditivo: sobe o solo um degrau acima do ruído da leitura
+    degrau = max(1.0, 3 * ruido)
+    pulso_ms = min(max(degrau / ganho * 60000, PULSO_MIN_MS), PULSO_MAX_MS)
+    # Zona morta da rega contínua: histerese contra o ruído menos o que ainda sobe depois
+    zona_morta = max(0.0, min(2 * ruido, 5.0) - (m["sobressinal"] or 0))
+    # Antecipação: a água do pulso precisa chegar ao sensor antes do alvo ser cruzado
+    antecipacao = 2 * (m["atraso_min"] or 5) + pulso_ms / 60000
+    return {
+        "pulso_ms": int(pulso_ms),
+        "zona_morta": round(zona_morta, 2),
+        "antecipacao_min": int(min(max(antecipacao, ANTECIPACAO_MIN), ANTECIPACAO_MAX)),
+        "ganho_rega": round(ganho, 3),
+        "secagem": round(m["seca_du"] / m["seca_min"], 4) if m["seca_min"] > 0 else None,
+    }
+
+def mudou(novos, atuais):
+    """Só publica versão nova quando os parâmetros mudam de forma relevante."""
+    if atuais is None:
+        return True
+    return (abs(novos["pulso_ms"] - atuais["pulso_ms"]) > 0.1 * atuais["pulso_ms"]
+            or abs(novos["zona_morta"] - atuais["zona_morta"]) > 0.25
+            or abs(novos["antecipacao_min"] - atuais["antecipacao_min"]) >= 3)
+
+def ajustar_dispositivo(dispositivo):
+    """Uma passada incremental: lê só os registros inseridos depois da marca do dispositivo."""
+    estado = ajuste_col.find_one({"_id": dispositivo}) or {"_id": dispositivo, "modelo": modelo_vazio()}
+    consulta = {"dispositivo": dispositivo, "ts": {"$exists": True}}
+    if "marca_id" in estado:
+        consulta["_id"] = {"$gt": estado["marca_id"]}
+    elif "marca" in estado:
+        consulta["ts"] = {"$gt": estado.pop("marca")}   # Marca antiga, por ts
+    docs = list(hist_col.find(consulta, {"umidade": 1, "bomba": 1, "umidade_desvio": 1, "ts": 1})
+                .sort("_id", 1).limit(AJUSTE_LOTE))
+    if not docs:
+        return
+    estado["marca_id"] = docs[-1]["_id"]
+    modelo = estado["modelo"]
+    for doc in sorted(docs, key=lambda d: d["ts"]):
+        atualizar_modelo(modelo, doc)
+
+    novos = parametros_de(modelo)
+    atuais = estado.get("parametros")
+    if novos and mudou(novos, atuais):
+        novos["versao"] = (atuais or {}).get("versao", 0) + 1
+        estado["parametros"] = novos
+        print(f"Controle de {dispositivo}: {novos}")
+    ajuste_col.replace_one({"_id": dispositivo}, estado, upsert=True)
+    if estado.get("parametros"):
+        with trava_parametros:
+            parametros_controle[dispositivo] = estado["parametros"]
+
+def carregar_parametros():
+    try:
+        for estado in ajuste_col.find({"parametros": {"$exists": True}}, {"parametros": 1}):
+            parametros_controle[estado["_id"]] = estado["parametros"]
+    except Exception as e:
+        print(f"Erro ao carregar parâmetros de controle: {e}")
+
+def ajustador():
+    """Thread do auto-ajuste: uma passada por dispositivo conhecido a cada AJUSTE_INTERVALO_S."""
+    while True:
+        time.sleep(AJUSTE_INTERVALO_S)
+        with trava_ultima:
+            dispositivos = list(ultima_leitura)
+        for dispositivo in dispositivos:
+            try:
+                ajustar_dispositivo(dispositivo)
+            except Exception as e:
+                print(f"Erro no auto-ajuste de {dispositivo}: {e}")
+
+def gravador_lotes():
+    """Thread de gravação: bloqueia até haver dados e drena até LOTE_MAX por vez."""
+    while True:
+        lote = [fila_ingestao.get()]
+        while len(lote) < LOTE_MAX:
+            try:
+                lote.append(fila_ingestao.get_nowait())
+            except queue.Empty:
+                break
+        gravar_lote(lote)
+        persistir_ultima({doc["dispositivo"] for doc in lote})
+        persistir_replay()
+        for _ in lote:
+            fila_ingestao.task_done()
+
+def retry_after_s(profundidade: int) -> int:
+    """Segundos sugeridos aos nós, proporcionais à ocupação da fila acima de FILA_ALERTA."""
+    if profundidade < FILA_ALERTA:
+        return 0
+    fracao = (profundidade - FILA_ALERTA) / max(1, FILA_MAX - FILA_ALERTA)
+    return max(1, math.ceil(fracao * RETRY_AFTER_MAX_S))
+
+@asynccontextmanager
+async def lifespan(app):
+    carregar_ultima()
+    carregar_parametros()
+    threading.Thread(target=gravador_lotes, name="gravador", daemon=True).start()
+    threading.Thread(target=compactador, name="compactador", daemon=True).start()
+    threading.Thread(target=vigia_alertas, name="alertas", daemon=True).start()
+    threading.Thread(target=ajustador, name="ajustador", daemon=True).start()
+    yield
+    # Dá um tempo para a fila esvaziar antes de encerrar
+    limite = time.monotonic() + 10
+    while fila_ingestao.unfinished_tasks and time.monotonic() < limite:
+        time.sleep(0.1)
+    persistir_replay()
 
 # === FASTAPI APP ===
 app = FastAPI(
     title="API de Umidade do Solo (ESP32)",
     description="Backend simplificado para registro e consulta de dados de umidade do sensor do ESP32.",
-    version="1.0.0"
+    version="1.0.0",
+    lifespan=lifespan
 )
 
 # === CORS (para frontend web ou testes) ===
@@ -46,6 +744,8 @@ app.add_middleware(
     allow_credentials=True,
     allow_methods=["*"],
     allow_headers=["*"],
+    # O dashboard lê o ETag para mandar If-None-Match; o cursor da exportação vai em header
+    expose_headers=["ETag", "X-Cursor-Proximo"],
 )
 
 # === AUTENTICAÇÃO SIMPLES VIA HEADER ===
@@ -56,11 +756,157 @@ def check_api_key(x_api_key: str = Header(...)):
         raise HTTPException(status_code=401, detail="Chave API inválida ou ausente no header X-API-Key.")
     return x_api_key
 
+# === ASSINATURA DO UPLINK (HMAC) ===
+# O nó assina "dispositivo\nboot\nseq\ntimestamp\n" + corpo com a chave gravada na
+# sua NVS (scripts/provisionar_chave.py). Chaves ficam em cache na memória; a
+# janela anti-replay é deslizante por (boot, seq), como no IPsec. O maior
+# (boot, seq) aceito vai para o documento da chave ("replay" = boot << 32 | seq),
+# gravado pelo gravador junto com o lote, para que um restart do backend não
+# reabra a janela; reprovisionar reescreve o documento e zera a marca.
+cache_chaves = {}   # dispositivo -> (chave ou None, lida em)
+trava_chaves = threading.Lock()
+janela_replay = {}  # dispositivo -> [chave, boot, maior seq, mapa de bits dos anteriores]
+replay_pendente = set()  # dispositivos com marca ainda não persistida
+trava_replay = threading.Lock()
+
+def chave_dispositivo(dispositivo, recarregar=False):
+    """Chave HMAC do dispositivo (None se não provisionado), com cache."""
+    agora = time.monotonic()
+    with trava_chaves:
+        item = cache_chaves.get(dispositivo)
+    if item:
+        idade = agora - item[1]
+        if idade < CHAVES_CACHE_TTL_S and not (recarregar and idade >= CHAVES_RECARGA_MIN_S):
+            return item[0]
+    doc = chaves_col.find_one({"_id": dispositivo})
+    chave = bytes.fromhex(doc["chave"]) if doc else None
+    with trava_chaves:
+        cache_chaves[dispositivo] = (chave, agora)
+    return chave
+
+def assinatura_valida(chave, dispositivo, boot, seq, ts, corpo, assinatura):
+    """Confere o HMAC-SHA256 (comparação em tempo constante)."""
+    mensagem = f"{dispositivo}\n{boot}\n{seq}\n{ts}\n".encode() + corpo
+    esperada = hmac.new(chave, mensagem, hashlib.sha256).hexdigest()
+    return hmac.compare_digest(esperada, assinatura.lower())
+
+def marca_replay(dispositivo):
+    """Maior (boot, seq) persistido do dispositivo (None se ainda não há)."""
+    doc = chaves_col.find_one({"_id": dispositivo}, {"replay": 1})
+    marca = (doc or {}).get("replay")
+    return None if marca is None else (marca >> 32, marca & 0xFFFFFFFF)
+
+def persistir_replay():
+    """Grava a marca anti-replay dos dispositivos pendentes ($max: nunca recua)."""
+    with trava_replay:
+        itens = [(d, *janela_replay[d][:3]) for d in replay_pendente if d in janela_replay]
+        replay_pendente.clear()
+    for dispositivo, chave, boot, seq in itens:
+        try:
+            # Filtrar pela chave evita ressuscitar a marca de uma chave já reprovisionada
+            chaves_col.update_one({"_id": dispositivo, "chave": chave.hex()},
+                                  {"$max": {"replay": (boot << 32) | seq}})
+        except Exception as e:
+            print(f"Erro ao gravar marca anti-replay de {dispositivo}: {e}")
+
+def aceitar_seq(dispositivo, chave, boot, seq, marca=None):
+    """
+    Registra (boot, seq) na janela do dispositivo; False se repetido ou velho demais.
+    `marca` é o (boot, seq) persistido, usado quando ainda não há janela na memória.
+    """
+    with trava_replay:
+        estado = janela_replay.get(dispositivo)
+        if estado is None and marca is not None and (boot, seq) <= marca:
+            return False
+        # Boot novo (ou chave reprovisionada, que zera o contador de boots): janela nova
+        if estado is None or estado[0] != chave or boot > estado[1]:
+            janela_replay[dispositivo] = [chave, boot, seq, 1]
+            replay_pendente.add(dispositivo)
+            return True
+        _, boot_atual, maior, mapa = estado
+        if boot < boot_atual:
+            return False
+        if seq > maior:
+            mapa = ((mapa << (seq - maior)) | 1) & ((1 << JANELA_REPLAY) - 1)
+            estado[2:] = [seq, mapa]
+            replay_pendente.add(dispositivo)
+            return True
+        atras = maior - seq
+        if atras >= JANELA_REPLAY or (mapa >> atras) & 1:
+            return False
+        estado[3] = mapa | (1 << atras)
+        return True
+
+async def verificar_origem(
+    request: Request,
+    x_api_key: Optional[str] = Header(None),
+    x_dispositivo: Optional[str] = Header(None),
+    x_boot: Optional[int] = Header(None),
+    x_seq: Optional[int] = Header(None),
+    x_timestamp: Optional[int] = Header(None),
+    x_assinatura: Optional[str] = Header(None),
+):
+    """
+    Autentica um nó: assinatura HMAC ou, sem ela (firmware antigo / nó sem chave),
+    o X-API-Key. Devolve o dispositivo assinante (None no modo X-API-Key).
+    """
+    if x_assinatura is None:
+        if ASSINATURA_OBRIGATORIA:
+            raise HTTPException(status_code=401, detail="Requisição sem assinatura.")
+        check_api_key(x_api_key)
+        return None
+    if x_dispositivo is None or x_boot is None or x_seq is None or x_timestamp is None:
+        raise HTTPException(status_code=401, detail="Cabeçalhos de assinatura incompletos.")
+    # Timestamp 0 = nó ainda sem NTP; só é tolerado enquanto a assinatura é opcional
+    if x_timestamp == 0 and ASSINATURA_OBRIGATORIA:
+        raise HTTPException(status_code=401, detail="Timestamp ausente (nó sem NTP).")
+    if x_timestamp and abs(time.time() - x_timestamp) > ASSINATURA_TOLERANCIA_S:
+        raise HTTPException(status_code=401, detail="Timestamp fora da tolerância.")
+
+    corpo = await request.body()
+    chave = await run_in_threadpool(chave_dispositivo, x_dispositivo)
+    valida = chave is not None and assinatura_valida(chave, x_dispositivo, x_boot, x_seq, x_timestamp, corpo, x_assinatura)
+    if not valida:
+        # Chave pode ter sido reprovisionada depois de entrar no cache
+        chave = await run_in_threadpool(chave_dispositivo, x_dispositivo, True)
+        valida = chave is not None and assinatura_valida(chave, x_dispositivo, x_boot, x_seq, x_timestamp, corpo, x_assinatura)
+    if not valida:
+        raise HTTPException(status_code=401, detail="Assinatura inválida.")
+    marca = None
+    if x_dispositivo not in janela_replay:
+        # Primeira requisição desde que o backend subiu: retoma da marca persistida
+        marca = await run_in_threadpool(marca_replay, x_dispositivo)
+    if not aceitar_seq(x_dispositivo, chave, x_boot, x_seq, marca):
+        raise HTTPException(status_code=401, detail="Requisição repetida (replay).")
+    return x_dispositivo
+
 # === MODELOS PYDANTIC ===
 
 class UmidadeRegistro(BaseModel):
     """Modelo para o dado de umidade enviado pelo ESP32."""
     umidade: float
+    # Identificação do nó (derivada do MAC); ausente em firmwares antigos
+    dispositivo: Optional[str] = None
+    # Resumo do intervalo entre envios (opcional: firmwares antigos mandam só "umidade")
+    n: Optional[int] = None
+    min: Optional[float] = None
+    max: Optional[float] = None
+    media: Optional[float] = None
+    desvio: Optional[float] = None
+    # Painel OLED presente e funcionando (False = nó operando headless)
+    display: Optional[bool] = None
+    # Bomba ligada no momento do envio
+    bomba: Optional[bool] = None
+    # Estimador de secagem do nó (só quando confiável): %/h e minutos até o alvo
+    taxa: Optional[float] = None
+    eta_min: Optional[int] = None
+    # Sensor ambiente (SHT3x), enviado só quando há medição válida
+    temp_ar: Optional[float] = None
+    umid_ar: Optional[float] = None
+    # Tempo que o lote esperou na fila do nó antes deste envio (backend fora, retentativas)
+    idade_ms: Optional[int] = None
+    # Versão dos parâmetros de controle em uso no nó (0 = padrões do firmware)
+    cfg: Optional[int] = None
 
     @field_validator('umidade')
     def check_range(cls, v):
@@ -73,8 +919,41 @@ class DadosGrafico(BaseModel):
     """Modelo de resposta para o endpoint de gráfico."""
     timestamps: list[str]
     umidades: list[float]
+    # Nó de cada ponto (o dashboard guarda o cache por nó: rótulos se repetem entre nós)
+    dispositivos: list[str]
+    # Média, mínimo e máximo de cada intervalo (iguais a "umidades" em registros sem resumo)
+    medias: list[float]
+    minimos: list[float]
+    maximos: list[float]
     media_ultima_hora: float
     amostras: int
+    # Leituras por ponto (peso da média) e nível consultado: o dashboard guarda os
+    # pontos em cache por nível e recalcula a média ao juntar deltas
+    pesos: list[int]
+    nivel: str
+    # Passar em "depois" na próxima busca (delta em ordem de gravação)
+    cursor: str
+
+# === CAPTURAS RÁPIDAS ===
+
+def decodificar_captura(blob: bytes) -> list[int]:
+    """Decodifica o blob do ESP32 (varint LEB128 de deltas em zigzag) em amostras do ADC."""
+    amostras = []
+    valor = 0
+    z = 0
+    shift = 0
+    for b in blob:
+        z |= (b & 0x7F) << shift
+        if b & 0x80:
+            shift += 7
+            continue
+        valor += (z >> 1) ^ -(z & 1)
+        amostras.append(valor)
+        z = 0
+        shift = 0
+    if shift:
+        raise ValueError("Blob de captura truncado.")
+    return amostras
 
 # === ENDPOINTS ===
 
@@ -82,41 +961,171 @@ class DadosGrafico(BaseModel):
 def health():
     """Endpoint de verificação de saúde."""
     tz = pytz.timezone(TIMEZONE_STR)
-    return {"status": "ok", "timestamp": datetime.now(tz).isoformat()}
+    return {
+        "status": "ok",
+        "timestamp": datetime.now(tz).isoformat(),
+        "fila_ingestao": fila_ingestao.qsize(),
+    }
 
 # --- ENDPOINTS PARA O ESP32 (REGISTRO) ---
 
 @app.post("/api/umidade/registrar")
-def postar_umidade(item: UmidadeRegistro, api_key: str = Depends(check_api_key)):
-    """Recebe o dado de umidade do ESP32 e o armazena no MongoDB."""
+def postar_umidade(item: UmidadeRegistro, response: Response, assinante: Optional[str] = Depends(verificar_origem)):
+    """
+    Recebe o dado de umidade do ESP32 e o enfileira para gravação no MongoDB.
+    Com a fila carregada responde com Retry-After para o nó espaçar os envios.
+    """
+    if assinante and item.dispositivo not in (None, assinante):
+        raise HTTPException(status_code=403, detail="Dispositivo do corpo difere do assinante.")
     
     tz = pytz.timezone(TIMEZONE_STR)
+    # Lotes que esperaram na fila do nó são datados de quando foram fechados
+    atraso = timedelta(milliseconds=min(max(item.idade_ms or 0, 0), IDADE_LOTE_MAX_MS))
     # Formata o timestamp localmente para facilitar a leitura no DB
-    now_local = datetime.now(tz).strftime("%Y-%m-%dT%H:%M:%S")
+    now_local = (datetime.now(tz) - atraso).strftime("%Y-%m-%dT%H:%M:%S")
 
     doc = {
+        "_id": ObjectId(),
+        "dispositivo": assinante or item.dispositivo or DISPOSITIVO_PADRAO,
         "timestamp_local": now_local,
+        "ts": agora_utc() - atraso, # Data real (UTC) para o índice TTL e a compactação
         "umidade": float(item.umidade),
-        # Adicione o status da bomba se quiser registrar isso no futuro
     }
+    if item.n:
+        doc.update({
+            "amostras_intervalo": item.n,
+            "umidade_min": item.min,
+            "umidade_max": item.max,
+            "umidade_media": item.media,
+            "umidade_desvio": item.desvio,
+        })
+    if item.display is not None:
+        doc["display_ok"] = item.display
+    if item.bomba is not None:
+        doc["bomba"] = item.bomba
+    if item.eta_min is not None:
+        doc["taxa_secagem"] = item.taxa
+        doc["eta_irrigacao_min"] = item.eta_min
+    if item.temp_ar is not None:
+        doc["temperatura_ar"] = item.temp_ar
+        doc["umidade_ar"] = item.umid_ar
 
     try:
-        hist_col.insert_one(doc)
-        return {"status": "OK", "id": str(doc.get("_id", "")), "umidade": item.umidade}
+        fila_ingestao.put_nowait(doc)
+    except queue.Full:
+        raise HTTPException(
+            status_code=503,
+            detail="Fila de ingestão cheia, tente mais tarde.",
+            headers={"Retry-After": str(RETRY_AFTER_MAX_S)},
+        )
+
+    registrar_ultima(doc, atraso.total_seconds())
+    try:
+        avaliar_alertas(doc)
     except Exception as e:
-        raise HTTPException(status_code=500, detail=f"Erro ao inserir no MongoDB: {e}")
+        # O doc já está na fila: um erro aqui viraria 500 e reenvio (duplicata)
+        print(f"Erro ao avaliar alertas de {doc['dispositivo']}: {e}")
+
+    espera = retry_after_s(fila_ingestao.qsize())
+    if espera:
+        response.headers["Retry-After"] = str(espera)
+    resposta = {"status": "OK", "id": str(doc["_id"]), "umidade": item.umidade}
+    # Canal de configuração: parâmetros novos vão só a nós que os informam (cfg)
+    with trava_parametros:
+        parametros = parametros_controle.get(doc["dispositivo"])
+    if parametros and item.cfg is not None and item.cfg != parametros["versao"]:
+        resposta["config"] = {k: parametros[k] for k in ("versao", "pulso_ms", "zona_morta", "antecipacao_min")}
+    return resposta
 
 # --- ENDPOINTS PARA O FRONTEND (VISUALIZAÇÃO) ---
 
+@app.get("/api/alertas")
+def get_alertas():
+    """Alertas atualmente disparados (regra, dispositivo)."""
+    with trava_alerta:
+        return [{"regra": r, "dispositivo": d} for (r, d), st in estado_alerta.items() if st["ativo"]]
+
+@app.get("/api/umidade/atual")
+def get_umidade_atual(dispositivo: Optional[str] = None):
+    """
+    Última leitura de cada dispositivo (ou de um só), direto da memória.
+    "online" indica se o nó enviou algo nos últimos ONLINE_MAX_S segundos.
+    """
+    agora = time.time()
+    with trava_ultima:
+        if dispositivo is not None:
+            if dispositivo not in ultima_leitura:
+                raise HTTPException(status_code=404, detail="Dispositivo sem leituras.")
+            estados = [dict(ultima_leitura[dispositivo])]
+        else:
+            estados = [dict(e) for e in ultima_leitura.values()]
+    for estado in estados:
+        idade = agora - estado.pop("recebido_em", agora)
+        estado["idade_s"] = round(idade, 1)
+        estado["online"] = idade <= ONLINE_MAX_S
+    return estados[0] if dispositivo is not None else {"dispositivos": estados}
+
 @app.get("/historico/grafico", response_model=DadosGrafico)
 def get_dados_grafico(
     horas: int = 24, # Limita a consulta às últimas X horas
-    limit: int = 1000 # Limite máximo de pontos de dados
+    limit: int = 1000, # Limite máximo de pontos de dados
+    dispositivo: Optional[str] = None, # Filtra um nó (padrão: todos)
+    since: Optional[str] = None, # Só pontos com timestamp_local >= since (páginas da janela)
+    depois: Optional[str] = None, # Cursor: só pontos gravados/regravados depois dele (delta)
+    if_none_match: Optional[str] = Header(None)
 ):
     """
     Retorna dados de umidade formatados para plotagem em gráfico.
-    Usa um campo de tempo otimizado para o MongoDB.
+    Resposta em cache com ETag forte: If-None-Match igual devolve 304 sem corpo.
+    "cursor" na resposta vai em "depois" na próxima busca: pega pontos novos e
+    também os atrasados (datados no passado) e agregados refeitos. Com "since"
+    ou "depois" a consulta é pequena e vai direto ao banco, sem cache.
     """
+    if depois is not None and not ObjectId.is_valid(depois):
+        raise HTTPException(status_code=400, detail="Cursor inválido.")
+    horas = min(max(horas, 1), GRAFICO_HORAS_MAX)
+    limit = min(max(limit, 1), GRAFICO_LIMITE_MAX)
+    if since or depois:
+        return consultar_grafico(dispositivo, horas, limit, since, depois)
+    chave = (dispositivo, horas, limit)
+    entrada = cache_grafico_valido(chave)
+    if entrada is None:
+        with trava_cache:
+            trava = travas_chave.setdefault(chave, threading.Lock())
+        try:
+            with trava:
+                # Outro pedido pode ter preenchido o cache enquanto esperávamos
+                entrada = cache_grafico_valido(chave)
+                if entrada is None:
+                    corpo = json.dumps(consultar_grafico(dispositivo, horas, limit), separators=(",", ":")).encode()
+                    entrada = {
+                        "corpo": corpo,
+                        "etag": '"' + hashlib.sha1(corpo).hexdigest() + '"',
+                        "criado": time.monotonic(),
+                    }
+                    guardar_cache_grafico(chave, entrada)
+        finally:
+            # Consulta que falhou não deixa trava órfã (não há entrada para despejá-la)
+            with trava_cache:
+                if chave not in cache_grafico:
+                    travas_chave.pop(chave, None)
+
+    cabecalhos = {"ETag": entrada["etag"], "Cache-Control": "no-cache"}
+    if etag_confere(if_none_match, entrada["etag"]):
+        return Response(status_code=304, headers=cabecalhos)
+    return Response(content=entrada["corpo"], media_type="application/json", headers=cabecalhos)
+
+def colecao_grafico(horas: int):
+    """Escolhe o nível de detalhe pela janela (e pela retenção de cada nível)."""
+    if horas <= GRAFICO_MINUTO_A_PARTIR_H and (not RETENCAO_BRUTO_DIAS or horas <= RETENCAO_BRUTO_DIAS * 24):
+        return hist_col
+    if horas <= GRAFICO_HORA_A_PARTIR_H and (not RETENCAO_MINUTO_DIAS or horas <= RETENCAO_MINUTO_DIAS * 24):
+        return minuto_col
+    return hora_col
+
+def consultar_grafico(dispositivo: Optional[str], horas: int, limit: int, since: Optional[str] = None,
+                      depois: Optional[str] = None) -> dict:
+    """Consulta o MongoDB e monta as séries do gráfico."""
     try:
         tz = pytz.timezone(TIMEZONE_STR)
     except pytz.exceptions.UnknownTimeZoneError:
@@ -127,30 +1136,67 @@ def get_dados_grafico(
     cutoff_dt = datetime.now(tz) - timedelta(hours=horas)
     cutoff_str = cutoff_dt.strftime("%Y-%m-%dT%H:%M:%S")
 
-    query = {"timestamp_local": {"$gte": cutoff_str}}
-    
-    # Ordena por timestamp crescente para que o gráfico seja desenhado na ordem correta
-    cursor = hist_col.find(query).sort("timestamp_local", 1).limit(limit)
+    query = {"timestamp_local": {"$gte": max(cutoff_str, since or "")}}
+    if dispositivo:
+        query["dispositivo"] = dispositivo
+
+    colecao = colecao_grafico(horas)
+    if depois:
+        # Delta em ordem de gravação: o cursor avança pelo último ponto devolvido
+        query["atualizado"] = {"$gt": ObjectId(depois)}
+        cursor = colecao.find(query).sort("atualizado", 1).limit(limit)
+        proximo_cursor = depois
+    else:
+        # Janela em ordem de timestamp; o cursor é o do fim da coleção ANTES da
+        # leitura, então o delta seguinte cobre o que for gravado durante ela
+        topo = colecao.find_one({"atualizado": {"$exists": True}}, {"atualizado": 1},
+                                sort=[("atualizado", -1)])
+        proximo_cursor = str(topo["atualizado"]) if topo else str(ObjectId.from_datetime(datetime(2000, 1, 1)))
+        cursor = colecao.find(query).sort("timestamp_local", 1).limit(limit)
     
     timestamps = []
+    dispositivos = []
     umidades = []
+    medias = []
+    minimos = []
+    maximos = []
+    pesos = []
     soma_umidade = 0.0
+    peso_total = 0
     count = 0
 
     for doc in cursor:
+        if depois:
+            proximo_cursor = str(doc["atualizado"])
         timestamps.append(doc["timestamp_local"])
+        dispositivos.append(doc.get("dispositivo", DISPOSITIVO_PADRAO))
         umidade_val = float(doc["umidade"])
         umidades.append(umidade_val)
-        soma_umidade += umidade_val
+        # Registros com resumo pesam pelo número de leituras do intervalo
+        media_val = float(doc.get("umidade_media", umidade_val))
+        peso = int(doc.get("amostras_intervalo", 1))
+        medias.append(media_val)
+        minimos.append(float(doc.get("umidade_min", umidade_val)))
+        maximos.append(float(doc.get("umidade_max", umidade_val)))
+        pesos.append(peso)
+        soma_umidade += media_val * peso
+        peso_total += peso
         count += 1
         
-    media = round(soma_umidade / count, 2) if count > 0 else 0.0
+    media = round(soma_umidade / peso_total, 2) if peso_total > 0 else 0.0
 
     return {
         "timestamps": timestamps,
+        "dispositivos": dispositivos,
         "umidades": umidades,
+        "medias": medias,
+        "minimos": minimos,
+        "maximos": maximos,
         "media_ultima_hora": media,
-        "amostras": count
+        "amostras": count,
+        "pesos": pesos,
+        "nivel": {hist_col.name: "bruto", minuto_col.name: "minuto"}.get(colecao.name, "hora"),
+        "cursor": proximo_cursor,
     }
 
 @app.get("/historico")
@@ -159,9 +1205,220 @@ def get_historico(
     api_key: str = Depends(check_api_key) # Protegido, pois é uma consulta mais detalhada
 ):
     """Retorna os últimos N registros brutos. Útil para debug."""
-    cursor = hist_col.find({}).sort("timestamp_local", -1).limit(limit)
+    cursor = hist_col.find({}, {"atualizado": 0}).sort("timestamp_local", -1).limit(limit)
     items = []
     for doc in cursor:
         doc["_id"] = str(doc["_id"])
         items.append(doc)
-    return items
\ No newline at end of file
+    return items
+
+# --- EXPORTAÇÃO ---
+# Colunas fixas para que CSV e Parquet tenham o mesmo esquema em todos os blocos
+COLUNAS_EXPORT = [
+    ("_id", "str"), ("dispositivo", "str"), ("timestamp_local", "str"),
+    ("umidade", "float"), ("umidade_min", "float"), ("umidade_max", "float"),
+    ("umidade_media", "float"), ("umidade_desvio", "float"), ("amostras_intervalo", "int"),
+    ("bomba", "bool"), ("display_ok", "bool"), ("temperatura_ar", "float"), ("umidade_ar", "float"),
+    ("taxa_secagem", "float"), ("eta_irrigacao_min", "int"),
+]
+FORMATOS_EXPORT = {
+    "ndjson": "application/x-ndjson",
+    "csv": "text/csv",
+    "parquet": "application/vnd.apache.parquet",
+    "arrow": "application/vnd.apache.arrow.stream",
+}
+
+def blocos_export(query):
+    """Percorre o cursor em ordem de _id e entrega listas de até EXPORT_BLOCO linhas."""
+    projecao = {nome: 1 for nome, _ in COLUNAS_EXPORT}
+    cursor = hist_col.find(query, projecao).sort("_id", 1).batch_size(EXPORT_BLOCO)
+    bloco = []
+    for doc in cursor:
+        doc["_id"] = str(doc["_id"])
+        bloco.append(doc)
+        if len(bloco) >= EXPORT_BLOCO:
+            yield bloco
+            bloco = []
+    if bloco:
+        yield bloco
+
+def gerar_ndjson(query):
+    for bloco in blocos_export(query):
+        yield "".join(json.dumps(doc, separators=(",", ":")) + "\n" for doc in bloco).encode()
+
+def gerar_csv(query):
+    nomes = [nome for nome, _ in COLUNAS_EXPORT]
+    buf = io.StringIO()
+    escritor = csv.DictWriter(buf, fieldnames=nomes, extrasaction="ignore")
+    escritor.writeheader()
+    for bloco in blocos_export(query):
+        escritor.writerows(bloco)
+        yield buf.getvalue().encode()
+        buf.seek(0)
+        buf.truncate()
+    if buf.tell():
+        yield buf.getvalue().encode()
+
+class SaidaEmBlocos(io.RawIOBase):
+    """Destino de escrita do pyarrow que só acumula bytes até o gerador os esvaziar."""
+    def __init__(self):
+        self.partes = []
+        self.posicao = 0
+    def writable(self):
+        return True
+    def write(self, dados):
+        self.partes.append(bytes(dados))
+        self.posicao += len(dados)
+        return len(dados)
+    def tell(self):
+        return self.posicao
+    def esvaziar(self):
+        dados = b"".join(self.partes)
+        self.partes = []
+        return dados
+
+def gerar_colunar(query, formato):
+    """Parquet (um row group por bloco) ou Arrow IPC stream (um record batch por bloco)."""
+    import pyarrow as pa
+    import pyarrow.parquet as pq
+    tipos = {"str": pa.string(), "float": pa.float64(), "int": pa.int64(), "bool": pa.bool_()}
+    esquema = pa.schema([(nome, tipos[tipo]) for nome, tipo in COLUNAS_EXPORT])
+    saida = SaidaEmBlocos()
+    if formato == "parquet":
+        escritor = pq.ParquetWriter(saida, esquema, compression="zstd")
+    else:
+        escritor = pa.ipc.new_stream(saida, esquema)
+    for bloco in blocos_export(query):
+        tabela = pa.Table.from_pylist(bloco, schema=esquema)
+        if formato == "parquet":
+            escritor.write_table(tabela, row_group_size=len(bloco))
+        else:
+            escritor.write_table(tabela)
+        yield saida.esvaziar()
+    escritor.close()
+    yield saida.esvaziar()
+
+@app.get("/historico/exportar")
+def exportar_historico(
+    formato: str = "ndjson",
+    inicio: Optional[str] = None, # "YYYY-MM-DDTHH:MM:SS" (hora local, inclusivo)
+    fim: Optional[str] = None,    # idem, exclusivo
+    dispositivo: Optional[str] = None,
+    depois: Optional[str] = None, # Cursor: exporta só _id > depois (retomada)
+    limite: Optional[int] = None, # Máximo de registros nesta página
+    api_key: str = Depends(check_api_key)
+):
+    """
+    Exporta o histórico bruto em streaming, com memória constante (um bloco por vez).
+    Com "limite", o header X-Cursor-Proximo traz o valor de "depois" para a próxima página.
+    """
+    if formato not in FORMATOS_EXPORT:
+        raise HTTPException(status_code=400, detail=f"Formato inválido. Use: {', '.join(FORMATOS_EXPORT)}.")
+    if formato in ("parquet", "arrow"):
+        try:
+            import pyarrow  # noqa: F401
+        except ImportError:
+            raise HTTPException(status_code=501, detail="Exportação colunar requer pyarrow instalado.")
+
+    query = {}
+    if inicio or fim:
+        query["timestamp_local"] = {}
+        if inicio:
+            query["timestamp_local"]["$gte"] = inicio
+        if fim:
+            query["timestamp_local"]["$lt"] = fim
+    if dispositivo:
+        query["dispositivo"] = dispositivo
+    if depois:
+        if not ObjectId.is_valid(depois):
+            raise HTTPException(status_code=400, detail="Cursor inválido.")
+        query["_id"] = {"$gt": ObjectId(depois)}
+
+    cabecalhos = {"Content-Disposition": f'attachment; filename="historico.{formato}"'}
+    if limite:
+        # Fixa o fim da página antes de começar o streaming (só o índice de _id é lido),
+        # assim o cursor da próxima página já vai nos headers.
+        ultimo = list(hist_col.find(query, {"_id": 1}).sort("_id", 1).skip(limite - 1).limit(1))
+        if ultimo:
+            query.setdefault("_id", {})["$lte"] = ultimo[0]["_id"]
+            restante = dict(query, _id={"$gt": ultimo[0]["_id"]})
+            if hist_col.find_one(restante, {"_id": 1}):
+                cabecalhos["X-Cursor-Proximo"] = str(ultimo[0]["_id"])
+
+    if formato == "ndjson":
+        corpo = gerar_ndjson(query)
+    elif formato == "csv":
+        corpo = gerar_csv(query)
+    else:
+        corpo = gerar_colunar(query, formato)
+    return StreamingResponse(corpo, media_type=FORMATOS_EXPORT[formato], headers=cabecalhos)
+
+# --- CAPTURAS RÁPIDAS (DIAGNÓSTICO) ---
+
+@app.post("/api/captura")
+async def postar_captura(
+    request: Request,
+    x_captura_evento: str = Header(...),
+    x_captura_taxa: int = Header(...),
+    x_captura_pre: int = Header(0),
+    x_captura_amostras: int = Header(...),
+    assinante: Optional[str] = Depends(verificar_origem)
+):
+    """
+    Recebe uma captura rápida do ESP32 (ADC bruto em torno de liga/desliga da bomba).
+    O blob é validado e armazenado comprimido; a decodificação fica para a consulta.
+    """
+    blob = await request.body()
+    try:
+        n = len(decodificar_captura(blob))
+    except ValueError as e:
+        raise HTTPException(status_code=400, detail=str(e))
+    if n != x_captura_amostras:
+        raise HTTPException(status_code=400, detail=f"Captura com {n} amostras, esperado {x_captura_amostras}.")
+
+    tz = pytz.timezone(TIMEZONE_STR)
+    doc = {
+        "timestamp_local": datetime.now(tz).strftime("%Y-%m-%dT%H:%M:%S"),
+        "evento": x_captura_evento,
+        "taxa_hz": x_captura_taxa,
+        "pre_disparo": x_captura_pre,
+        "amostras": n,
+        "blob": blob,
+    }
+    if assinante:
+        doc["dispositivo"] = assinante
+    try:
+        await run_in_threadpool(capturas_col.insert_one, doc)
+    except Exception as e:
+        raise HTTPException(status_code=500, detail=f"Erro ao inserir no MongoDB: {e}")
+    if assinante:
+        # Capturas não passam pelo gravador: a marca anti-replay vai junto aqui
+        await run_in_threadpool(persistir_replay)
+    return {"status": "OK", "id": str(doc["_id"]), "amostras": n, "bytes": len(blob)}
+
+@app.get("/api/capturas")
+def listar_capturas(limit: int = 20, api_key: str = Depends(check_api_key)):
+    """Lista as últimas capturas (sem as amostras)."""
+    cursor = capturas_col.find({}, {"blob": 0}).sort("timestamp_local", -1).limit(limit)
+    items = []
+    for doc in cursor:
+        doc["_id"] = str(doc["_id"])
+        items.append(doc)
+    return items
+
+@app.get("/api/captura/{captura_id}")
+def get_captura(captura_id: str, api_key: str = Depends(check_api_key)):
+    """Retorna uma captura decodificada; o índice pre_disparo marca o evento da bomba."""
+    if not ObjectId.is_valid(captura_id):
+        raise HTTPException(status_code=400, detail="ID de captura inválido.")
+    doc = capturas_col.find_one({"_id": ObjectId(captura_id)})
+    if doc is None:
+        raise HTTPException(status_code=404, detail="Captura não encontrada.")
+    return {
+        "id": captura_id,
+        "timestamp_local": doc["timestamp_local"],
+        "evento": doc["evento"],
+        "taxa_hz": doc["taxa_hz"],
+        "pre_disparo": doc["pre_disparo"],
+        "amostras": decodificar_captura(doc["blob"]),
+    }
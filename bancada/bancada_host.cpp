@@ -0,0 +1,266 @@
+/* Bancada no host (Google Benchmark) da lógica pura do firmware (logica.h).
+   Os casos têm os mesmos nomes dos da placa quando medem o mesmo trabalho.
+   Complementa a bancada na placa (env esp32dev_bancada), que mede em ciclos o
+   mesmo código mais o que depende do hardware (analogRead, HMAC).
+   Build e JSON: ver bancada/CMakeLists.txt; comparação com scripts/bancada.py.
+*/
+#include <benchmark/benchmark.h>
+#include <stdarg.h>
+#include <string.h>
+#include "logica.h"
+
+// Calibração e filtro do perfil do laboratório
+constexpr int ADC_SECO = 3000;
+constexpr int ADC_MOLHADO = 1200;
+constexpr uint8_t JANELA = 8;
+#define PAYLOAD_MAX 384
+
+static void BM_adcToPct(benchmark::State& state) {
+  int i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(adcToPct(1200 + (i++ & 2047), ADC_SECO, ADC_MOLHADO));
+  }
+}
+BENCHMARK(BM_adcToPct)->Name("adcToPct");
+
+template <TipoFiltro F>
+static void BM_filtro(benchmark::State& state) {
+  FiltroLeitura<F, JANELA> filtro;
+  int i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(filtro.aplicar(i++ % 100));
+  }
+}
+BENCHMARK_TEMPLATE(BM_filtro, TipoFiltro::MEDIA_MOVEL)->Name("filtro_media");
+BENCHMARK_TEMPLATE(BM_filtro, TipoFiltro::EXPONENCIAL)->Name("filtro_ema");
+
+static void BM_estatistica(benchmark::State& state) {
+  EstatisticaIntervalo est;
+  int i = 0;
+  for (auto _ : state) {
+    est.adicionar(40 + (i++ % 200) * 0.1f);
+    benchmark::DoNotOptimize(est.m2);
+  }
+}
+BENCHMARK(BM_estatistica)->Name("estatistica");
+
+static void BM_juntar(benchmark::State& state) {
+  EstatisticaIntervalo a, b;
+  for (int i = 0; i < 30; i++) {
+    a.adicionar(40 + i * 0.3f);
+    b.adicionar(45 - i * 0.2f);
+  }
+  for (auto _ : state) {
+    EstatisticaIntervalo c = a;
+    benchmark::DoNotOptimize(c);
+    c.juntar(b);
+    benchmark::DoNotOptimize(c.m2);
+  }
+}
+BENCHMARK(BM_juntar)->Name("juntar");
+
+// Payload completo (ambiente e estimador presentes): o pior caso do envio
+static void BM_payload(benchmark::State& state) {
+  LoteEnvio l = {};
+  for (int i = 0; i < 5; i++) l.est.adicionar(48.5f + i * 0.25f);
+  l.seq = 1234;
+  l.loopMaxUs = 812;
+  l.temperaturaAr = 24.31f;
+  l.umidadeAr = 61.2f;
+  l.taxa = -0.021f;
+  l.etaMin = 187;
+  l.ambiente = l.secagem = l.display = true;
+  char buf[PAYLOAD_MAX];
+  unsigned long idade = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(montarPayload(buf, sizeof(buf), l, "esp32-A1B2C3", idade++, 3));
+  }
+}
+BENCHMARK(BM_payload)->Name("payload");
+
+// --- Composição das telas ---
+// Framebuffer 1 bpp 128x64 no layout do PainelOled, com a mesma API de texto do
+// Adafruit_GFX. O texto segue o laço do Adafruit_GFX::drawChar (célula 6x8,
+// pixel a pixel); só o desenho dos glifos é sintético (sem a fonte glcdfont).
+class CanvasHost {
+public:
+  static constexpr int16_t W = 128, H = 64;
+  uint8_t buffer[W * H / 8];
+
+  void clearDisplay() { memset(buffer, 0, sizeof(buffer)); }
+  void setTextSize(uint8_t) {}
+  void setTextColor(uint16_t c) { cor = c; }
+  void setCursor(int16_t x, int16_t y) { cx = x; cy = y; }
+
+  void drawPixel(int16_t x, int16_t y, uint16_t c) {
+    if (x < 0 || y < 0 || x >= W || y >= H) return;
+    uint8_t& b = buffer[(y / 8) * W + x];
+    uint8_t bit = 1 << (y & 7);
+    b = c ? (b | bit) : (b & ~bit);
+  }
+  void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t c) {
+    for (int16_t i = x; i < x + w; i++)
+      for (int16_t j = y; j < y + h; j++) drawPixel(i, j, c);
+  }
+  void drawRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t c) {
+    fillRect(x, y, w, 1, c);
+    fillRect(x, y + h - 1, w, 1, c);
+    fillRect(x, y, 1, h, c);
+    fillRect(x + w - 1, y, 1, h, c);
+  }
+
+  void print(const char* s) {
+    for (; *s; s++) {
+      if (*s == '\n') { cx = 0; cy += 8; continue; }
+      desenharChar(cx, cy, *s);
+      cx += 6;
+    }
+  }
+  void print(float v, int casas) { printf("%.*f", casas, v); }
+  void printf(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+    char buf[64];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    print(buf);
+  }
+
+private:
+  int16_t cx = 0, cy = 0;
+  uint16_t cor = COR_TEXTO;
+
+  void desenharChar(int16_t x, int16_t y, char ch) {
+    if (x >= W || y >= H || x + 6 <= 0 || y + 8 <= 0) return;
+    for (int8_t i = 0; i < 5; i++) {
+      uint8_t linha = (uint8_t)(ch * 0x9Du >> i) | 0x41;   // Glifo sintético
+      for (int8_t j = 0; j < 8; j++, linha >>= 1) {
+        if (linha & 1) drawPixel(x + i, y + j, cor);
+      }
+    }
+  }
+};
+
+CanvasHost canvas;
+
+// Partes dinâmicas: as mesmas chamadas das do firmware, com valores fixos
+constexpr float UMIDADE = 47.3f, SETPOINT = 50.0f;
+constexpr unsigned long INTERVALO_S = 10;
+
+static void desenharPrincipal() {
+  canvas.setCursor(0, 2);
+  canvas.print("IRRIGACAO ESP32");
+  canvas.setCursor(115, 2);
+  canvas.print("W");
+  int barX = 0, barY = 16, barW = 98, barH = 12;
+  int fill = (int)(UMIDADE * barW / 100);
+  canvas.drawRect(barX, barY, barW, barH, COR_TEXTO);
+  canvas.fillRect(barX + 1, barY + 1, fill > 2 ? fill - 2 : 0, barH - 2, COR_TEXTO);
+  canvas.setCursor(barW + 9, barY + 3);
+  canvas.print(UMIDADE, 0);
+  canvas.print("%");
+  canvas.setCursor(0, 31);
+  canvas.print("Alvo: ");
+  canvas.print(SETPOINT, 0);
+  canvas.print("%");
+  canvas.setCursor(0, 43);
+  canvas.print("Bomba: DESLIG");
+  canvas.setCursor(84, 43);
+  canvas.printf("~%ldm", 187L);
+}
+
+static void desenharMenuIntervalo() {
+  canvas.setCursor(0, Y_LINHAS[2]);
+  canvas.printf("C: API Update(%lu seg)", INTERVALO_S);
+}
+
+static void desenharSetpointAtual() {
+  canvas.setCursor(4, Y_LINHAS[0]);
+  canvas.printf("Alvo Atual: %.0f%%", SETPOINT);
+}
+
+static void desenharIntervaloAtual() {
+  canvas.setCursor(4, Y_LINHAS[0]);
+  canvas.printf("Atual: %lu seg", INTERVALO_S);
+}
+
+static void desenharAdc() {
+  canvas.setCursor(4, Y_LINHAS[2]);
+  canvas.printf("ADC: %d", 2104);
+}
+
+// Mesma tabela TELAS do firmware (textos, partes dinâmicas e mapa de teclas),
+// com ações vazias
+static void aplicarNada(long) {}
+static void acaoNada() {}
+constexpr CampoNumerico CAMPO_SETPOINT = { "Digite 0-100: ", 3, 0, 100, aplicarNada };
+constexpr CampoNumerico CAMPO_INTERVALO = { "Novo (seg): ", 4, 1, 9999, aplicarNada };
+constexpr AcaoTecla TECLAS_PRINCIPAL[] = { {'*', TELA_MENU_CONFIG, nullptr} };
+constexpr AcaoTecla TECLAS_MENU[] = {
+  {'A', TELA_CALIB_DRY, nullptr},
+  {'B', TELA_SETPOINT, nullptr},
+  {'C', TELA_API_INTERVAL_CONFIG, nullptr},
+  {'*', TELA_PRINCIPAL, nullptr},
+};
+constexpr AcaoTecla TECLAS_CAMPO[] = {
+  {'#', TELA_MENU_CONFIG, acaoNada},
+  {'*', TELA_MENU_CONFIG, nullptr},
+};
+constexpr AcaoTecla TECLAS_CALIB_DRY[] = {
+  {'#', TELA_CALIB_WET, acaoNada},
+  {'*', TELA_MENU_CONFIG, nullptr},
+};
+constexpr AcaoTecla TECLAS_CALIB_WET[] = {
+  {'#', TELA_MENU_CONFIG, acaoNada},
+  {'*', TELA_MENU_CONFIG, nullptr},
+};
+
+#define TECLAS(t) t, sizeof(t) / sizeof(t[0])
+
+constexpr DefTela TELAS[TELA_N] = {
+  { nullptr, {}, "*=Menu Config", desenharPrincipal, nullptr, TECLAS(TECLAS_PRINCIPAL) },
+  { "MENU CONFIGURACAO", {"A: Calibrar Sensor", "B: Configurar Alvo"}, "*: Voltar Principal",
+    desenharMenuIntervalo, nullptr, TECLAS(TECLAS_MENU) },
+  { "CONFIGURAR ALVO", {}, "#=OK *=Voltar", desenharSetpointAtual, &CAMPO_SETPOINT, TECLAS(TECLAS_CAMPO) },
+  { "CALIBRACAO", {"Sensor no AR SECO", "Pressione #"}, "#=OK *=Voltar", desenharAdc, nullptr, TECLAS(TECLAS_CALIB_DRY) },
+  { "CALIBRACAO", {"Sensor na AGUA", "Pressione #"}, "#=OK *=Voltar", desenharAdc, nullptr, TECLAS(TECLAS_CALIB_WET) },
+  { "CONFIG. INTERVALO", {}, "#=OK *=Voltar", desenharIntervaloAtual, &CAMPO_INTERVALO, TECLAS(TECLAS_CAMPO) },
+};
+
+// Igual ao caso "tecla" da placa: dígito no campo + saída da tela
+static void BM_tecla(benchmark::State& state) {
+  Tela tela;
+  char entrada[5] = "";
+  uint8_t entradaLen = 0;
+  const DefTela* telas = TELAS;
+  char digito = '5', sair = '*';
+  for (auto _ : state) {
+    // Tabela e teclas opacas: sem isso o compilador resolve tudo em constante
+    benchmark::DoNotOptimize(telas);
+    benchmark::DoNotOptimize(digito);
+    tela = TELA_SETPOINT;
+    processarTecla(telas, tela, entrada, entradaLen, digito);
+    processarTecla(telas, tela, entrada, entradaLen, sair);
+    benchmark::DoNotOptimize(tela);
+  }
+}
+BENCHMARK(BM_tecla)->Name("tecla");
+
+// Um caso por tela, com os mesmos nomes "tela_N" da placa (campo com dois dígitos)
+static void BM_tela(benchmark::State& state, Tela t) {
+  for (auto _ : state) {
+    comporTela(canvas, TELAS[t], "42");
+    benchmark::DoNotOptimize(canvas.buffer);
+    benchmark::ClobberMemory();
+  }
+}
+static const bool TELAS_REGISTRADAS = [] {
+  char nome[12];
+  for (uint8_t t = 0; t < TELA_N; t++) {
+    snprintf(nome, sizeof(nome), "tela_%u", t);
+    benchmark::RegisterBenchmark(nome, BM_tela, (Tela)t);
+  }
+  return true;
+}();
+
+BENCHMARK_MAIN();
@@ -1,20 +1,132 @@
 /* Sistema de Irrigação Inteligente com ESP32 (PlatformIO/VS Code)
-   - OLED SH1106 128x64
+   - OLED 128x64 (SSD1306 ou SH1106, escolhido pelo perfil)
    - Keypad 4x4
-   - Sensor de Umidade do Solo
+   - Sensor de Umidade do Solo (alimentação opcional por GPIO, só durante a leitura)
    - LED simulando bomba
    - Envio de dados para FastAPI local
+   - Gerenciamento de energia (clock dinâmico + modem sleep)
    
 */
 #include <WiFi.h>
-#include <HTTPClient.h>
+#include <lwip/sockets.h>
+#include <lwip/netdb.h>
+#include <Preferences.h>
+#include <mbedtls/md.h>
 #include <ArduinoJson.h>
 #include <Wire.h>
 #include <Keypad.h>
 #include <Adafruit_GFX.h>
-#include <Adafruit_SSD1306.h>
+#include <esp_wifi.h>
+#include <LittleFS.h>
+// AsyncTCP/ESPAsyncWebServer só estão nos lib_deps dos envs que servem o
+// dashboard local; sem elas o código do servidor nem é compilado
+#if __has_include(<ESPAsyncWebServer.h>)
+#define COM_SERVIDOR_WEB 1
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+#else
+#define COM_SERVIDOR_WEB 0
+#endif
+#ifdef ENERGIA_LIGHT_SLEEP
+#include <esp_pm.h>
+#endif
+// Filtro, conversão ADC, resumo do intervalo, payload e motor de menus
+// (sem Arduino: também compilado no host pela bancada em bancada/)
+#include "logica.h"
 
 
+// ==================== PERFIS DE PLACA ====================
+// Cada placa/variante é descrita por um PerfilPlaca constexpr. O perfil ativo é
+// escolhido na compilação (-DPERFIL_PLACA=... no platformio.ini) e os recursos
+// desligados (display, WiFi) somem do binário via if constexpr + gc-sections.
+
+enum class Transporte : uint8_t { NENHUM, HTTP };
+enum class ControladorOled : uint8_t { SSD1306, SH1106 };
+
+constexpr uint8_t SEM_PINO = 0xFF;
+
+struct PerfilPlaca {
+  const char* nome;
+  // Pinos
+  uint8_t pinoSolo;
+  uint8_t pinoBomba;
+  uint8_t pinoSda;
+  uint8_t pinoScl;
+  // Controle e aquisição
+  uint8_t zonas;
+  TipoFiltro filtro;
+  uint8_t janelaFiltro;            // Amostras da média móvel / constante da EMA
+  unsigned long intervaloSensor;   // ms
+  unsigned long intervaloEnvio;    // ms (valor inicial, ajustável no menu)
+  Transporte transporte;
+  // Interface
+  bool temDisplay;
+  uint8_t larguraTela;
+  uint8_t alturaTela;
+  // Calibração padrão do sensor
+  int adcSeco;
+  int adcMolhado;
+  // Recursos opcionais (campos com padrão: perfis antigos não precisam listá-los)
+  bool capturaRapida = true;       // Captura em alta taxa em torno da bomba
+  bool sensorAmbiente = true;      // SHT3x no barramento do OLED (detectado no boot)
+  bool painelLocal = true;         // Dashboard servido pelo próprio ESP32
+  ControladorOled controladorOled = ControladorOled::SSD1306;
+  uint8_t pinoSonda = SEM_PINO;    // GPIO que alimenta a sonda (SEM_PINO: sempre ligada)
+  uint16_t estabilizacaoSonda = 20;  // ms entre ligar a sonda e a leitura valer
+};
+
+// Bancada do laboratório: display, média móvel e envio a cada 10 s
+constexpr PerfilPlaca PERFIL_LAB111 = {
+  "lab111",
+  36, 26, 5, 4,
+  1, TipoFiltro::MEDIA_MOVEL, 8, 2000, 10000, Transporte::HTTP,
+  true, 128, 64,
+  3000, 1200
+};
+
+// Nó a bateria: EMA (sem buffer), leituras e envios mais espaçados
+constexpr PerfilPlaca PERFIL_BATERIA = {
+  "bateria",
+  36, 26, 5, 4,
+  1, TipoFiltro::EXPONENCIAL, 8, 10000, 60000, Transporte::HTTP,
+  true, 128, 64,
+  3000, 1200,
+  false,  // Sem captura rápida: a tarefa de 200 Hz impediria o light sleep
+  true,
+  false,  // Sem dashboard local: servidor web mantém o rádio ocupado
+  ControladorOled::SSD1306,
+  27, 20  // VCC da sonda no GPIO27: alimentada só em torno de cada leitura
+};
+
+// Nó só de sensoriamento: sem display (headless), controle e envio normais
+constexpr PerfilPlaca PERFIL_SENSOR = {
+  "sensor",
+  36, 26, 5, 4,
+  1, TipoFiltro::MEDIA_MOVEL, 8, 2000, 10000, Transporte::HTTP,
+  false, 128, 64,
+  3000, 1200
+};
+
+#ifndef PERFIL_PLACA
+#define PERFIL_PLACA PERFIL_LAB111
+#endif
+constexpr const PerfilPlaca& PERFIL = PERFIL_PLACA;
+
+// O controle atual atende uma única zona (um sensor, uma bomba)
+static_assert(PERFIL.zonas == 1, "Controle multi-zona ainda nao suportado");
+static_assert(PERFIL.janelaFiltro > 0, "Janela do filtro deve ser positiva");
+static_assert(PERFIL.estabilizacaoSonda < PERFIL.intervaloSensor,
+              "Estabilizacao da sonda deve caber no intervalo de leitura");
+
+constexpr bool TEM_DISPLAY = PERFIL.temDisplay;
+constexpr bool TEM_WIFI = PERFIL.transporte == Transporte::HTTP;
+constexpr bool TEM_CAPTURA = PERFIL.capturaRapida && TEM_WIFI;
+constexpr bool TEM_AMBIENTE = PERFIL.sensorAmbiente;
+constexpr bool TEM_PAINEL_LOCAL = PERFIL.painelLocal && TEM_WIFI;
+static_assert(COM_SERVIDOR_WEB || !TEM_PAINEL_LOCAL,
+              "Perfil com painelLocal: adicione AsyncTCP e ESPAsyncWebServer aos lib_deps do env");
+constexpr bool TEM_GATE_SONDA = PERFIL.pinoSonda != SEM_PINO;
+
 // ==================== CONFIGURAÇÃO GERAL ====================
 
 // WiFi
@@ -22,178 +134,1668 @@ const char* ssid = "Lab111";
 const char* password = "i9lab111";
 
 // FASTAPI HOST: SUBSTITUA PELO IP REAL DO SEU PC
+// (env esp32dev_falhas: aponta para scripts/injecao_falhas.py via -DFASTAPI_HOST_TESTE)
 
+#ifdef FASTAPI_HOST_TESTE
+const char* FASTAPI_HOST = FASTAPI_HOST_TESTE;
+const int FASTAPI_PORT = FASTAPI_PORT_TESTE;
+#else
 const char* FASTAPI_HOST = "192.168.0.103"; 
 const int FASTAPI_PORT = 8000;
+#endif
 
-// Intervalo de envio para API: Inicialmente 10 segundos (10000 ms).
+// Intervalo de envio para API: valor inicial vem do perfil (10 s no lab111).
 // Esta variável será alterada pelo usuário no menu de configuração (tecla 'C').
-unsigned long API_SEND_INTERVAL = 10000; 
+unsigned long API_SEND_INTERVAL = PERFIL.intervaloEnvio; 
 
 // CHAVE API (Corrigido para o valor do .env)
 const char* API_SECRET_KEY = "minha-chave-secreta-esp32-123"; 
 
-// Pinos
-#define SOIL_PIN    36
-#define LED_PIN     26
-#define OLED_SDA    5
-#define OLED_SCL    4
+// Pinos (do perfil)
+constexpr uint8_t SOIL_PIN = PERFIL.pinoSolo;
+constexpr uint8_t LED_PIN  = PERFIL.pinoBomba;
+constexpr uint8_t OLED_SDA = PERFIL.pinoSda;
+constexpr uint8_t OLED_SCL = PERFIL.pinoScl;
 
 // OLED 
-#define SCREEN_WIDTH 128
-#define SCREEN_HEIGHT 64
-#define OLED_RESET -1
-Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, OLED_RESET);
+constexpr uint8_t SCREEN_WIDTH  = PERFIL.larguraTela;
+constexpr uint8_t SCREEN_HEIGHT = PERFIL.alturaTela;
+#define OLED_ADDR  0x3C
+#define OLED_I2C_HZ 400000              // Fast mode (o SHT3x no mesmo barramento também aceita)
+#define DISPLAY_REPROBE_INTERVAL 30000  // Procura o painel de novo a cada 30s se ausente
+#define DISPLAY_FALHAS_MAX       3      // Envios seguidos sem ACK até dar o painel como ausente
+
+// Keypad 4x4
+const byte ROWS = 4;
+const byte COLS = 4;
+char keys[ROWS][COLS] = {
+  {'1','2','3','A'},
+  {'4','5','6','B'},
+  {'7','8','9','C'},
+  {'*','0','#','D'}
+};
+
+byte rowPins[ROWS] = {25, 16, 0, 2};
+byte colPins[COLS] = {15, 13, 12, 14};
+Keypad keypad = Keypad(makeKeymap(keys), rowPins, colPins, ROWS, COLS);
+
+// Energia
+// 80 MHz é o menor clock que mantém o WiFi funcionando; 240 MHz só durante envios.
+#define CPU_MHZ_OCIOSO        80
+#define CPU_MHZ_REDE          240
+// Modem sleep: o rádio acorda a cada WIFI_LISTEN_INTERVAL beacons (DTIM) entre envios
+#define WIFI_LISTEN_INTERVAL  3
+// Consumo médio estimado por estado (mA) e capacidade da bateria para o relatório
+#define CORRENTE_OCIOSO_MA    20.0
+#define CORRENTE_ATIVO_MA     32.0
+#define CORRENTE_REDE_MA      120.0
+#define BATERIA_MAH           2500.0
+#define RELATORIO_ENERGIA_INTERVAL 60000
+
+// ==================== DRIVER OLED (SSD1306 / SH1106) ====================
+// Framebuffer no formato de página dos dois controladores (1 byte = 8 pixels
+// na vertical, página = 8 linhas) e uma cópia do que o painel está mostrando:
+// display() compara as duas e envia, por página, só a faixa de colunas que
+// mudou. Os dois controladores são usados em modo de página (comandos B0+p e
+// coluna); o SH1106 tem 132 colunas de RAM e o painel começa na coluna 2. O
+// controlador vem do perfil, em tempo de compilação.
+
+constexpr uint16_t OLED_BRANCO = 1;
+constexpr uint16_t OLED_PRETO = 0;
+static_assert(COR_TEXTO == OLED_BRANCO, "comporTela (logica.h) desenha com COR_TEXTO");
+#define OLED_I2C_BLOCO  32   // Bytes de dados por transação (cabe no buffer do Wire com folga)
+
+template <ControladorOled C, uint8_t W, uint8_t H>
+class PainelOled : public Adafruit_GFX {
+public:
+  static constexpr uint8_t PAGINAS = H / 8;
+  static constexpr uint8_t COLUNA_INICIAL = C == ControladorOled::SH1106 ? 2 : 0;
+
+  PainelOled() : Adafruit_GFX(W, H) {}
+
+  // Aloca os buffers (uma vez) e inicializa o controlador
+  bool begin(uint8_t endereco) {
+    this->endereco = endereco;
+    if (!buffer) {
+      buffer = (uint8_t*)calloc(2, W * PAGINAS);
+      if (!buffer) return false;
+      noPainel = buffer + W * PAGINAS;
+    }
+    static const uint8_t INICIO_COMUM[] = {
+      0xAE,                // Painel desligado durante a configuração
+      0xD5, 0x80,          // Clock do oscilador
+      0xA8, H - 1,         // Multiplex = altura
+      0xD3, 0x00,          // Sem deslocamento vertical
+      0x40,                // Linha inicial 0
+      0xA1, 0xC8,          // Espelha colunas e linhas (conector em cima)
+      0xDA, H == 64 ? 0x12 : 0x02,
+      0x81, 0xCF,          // Contraste
+      0xD9, 0xF1,          // Pré-carga
+      0xDB, 0x40,          // Nível VCOMH
+      0xA4, 0xA6,          // Mostra a RAM, sem inverter
+    };
+    // Fonte de alta tensão: charge pump no SSD1306, DC-DC no SH1106.
+    // No SSD1306 o modo de endereçamento também vai para "página" (0x20 0x02).
+    static const uint8_t INICIO_SSD1306[] = { 0x8D, 0x14, 0x20, 0x02 };
+    static const uint8_t INICIO_SH1106[] = { 0xAD, 0x8B };
+    bool ok = comandos(INICIO_COMUM, sizeof(INICIO_COMUM));
+    if constexpr (C == ControladorOled::SH1106) {
+      ok = ok && comandos(INICIO_SH1106, sizeof(INICIO_SH1106));
+    } else {
+      ok = ok && comandos(INICIO_SSD1306, sizeof(INICIO_SSD1306));
+    }
+    invalidar();
+    clearDisplay();
+    display();
+    return ok && comando(0xAF);
+  }
+
+  void clearDisplay() {
+    memset(buffer, 0, W * PAGINAS);
+  }
+
+  void drawPixel(int16_t x, int16_t y, uint16_t cor) override {
+    if (x < 0 || y < 0 || x >= W || y >= H) return;
+    uint8_t& b = buffer[(y / 8) * W + x];
+    uint8_t bit = 1 << (y & 7);
+    if (cor == OLED_BRANCO) b |= bit;
+    else b &= ~bit;
+  }
+
+  // Envia só as colunas alteradas de cada página; false se o I2C falhou
+  bool display() {
+    for (uint8_t p = 0; p < PAGINAS; p++) {
+      const uint8_t* novo = buffer + p * W;
+      uint8_t* atual = noPainel + p * W;
+      int16_t ini = 0;
+      int16_t fim = W - 1;
+      if (!tudoSujo) {
+        while (ini < W && novo[ini] == atual[ini]) ini++;
+        if (ini == W) continue;
+        while (novo[fim] == atual[fim]) fim--;
+      }
+      if (!enviarFaixa(p, ini, fim, novo + ini)) {
+        tudoSujo = true;   // Falha no barramento: na próxima reenvia tudo
+        return false;
+      }
+      memcpy(atual + ini, novo + ini, fim - ini + 1);
+    }
+    tudoSujo = false;
+    return true;
+  }
+
+  // Conteúdo do painel desconhecido (reinício, falha): o próximo display() manda tudo
+  void invalidar() { tudoSujo = true; }
+
+  bool comando(uint8_t c) { return comandos(&c, 1); }
+
+  bool contraste(uint8_t valor) {
+    const uint8_t cmds[] = { 0x81, valor };
+    return comandos(cmds, sizeof(cmds));
+  }
+
+  // Sleep do controlador: painel apagado, RAM (e a cópia em noPainel) preservada
+  bool dormir() { return comando(0xAE); }
+  bool acordar() { return comando(0xAF); }
+
+private:
+  uint8_t endereco = 0;
+  uint8_t* buffer = nullptr;     // O que as telas desenham
+  uint8_t* noPainel = nullptr;   // O que o painel mostra
+  bool tudoSujo = true;
+
+  // Lista de comandos numa transação só (byte de controle 0x00)
+  bool comandos(const uint8_t* cmds, size_t n) {
+    Wire.beginTransmission(endereco);
+    Wire.write((uint8_t)0x00);
+    Wire.write(cmds, n);
+    return Wire.endTransmission() == 0;
+  }
+
+  bool enviarFaixa(uint8_t pagina, uint8_t ini, uint8_t fim, const uint8_t* dados) {
+    uint8_t coluna = ini + COLUNA_INICIAL;
+    const uint8_t posicao[] = {
+      (uint8_t)(0xB0 | pagina), (uint8_t)(coluna & 0x0F), (uint8_t)(0x10 | (coluna >> 4))
+    };
+    if (!comandos(posicao, sizeof(posicao))) return false;
+    // Dados em blocos (byte de controle 0x40); a coluna avança sozinha dentro da página
+    for (size_t enviado = 0, total = fim - ini + 1; enviado < total; enviado += OLED_I2C_BLOCO) {
+      Wire.beginTransmission(endereco);
+      Wire.write((uint8_t)0x40);
+      Wire.write(dados + enviado, min(total - enviado, (size_t)OLED_I2C_BLOCO));
+      if (Wire.endTransmission() != 0) return false;
+    }
+    return true;
+  }
+};
+
+PainelOled<PERFIL.controladorOled, SCREEN_WIDTH, SCREEN_HEIGHT> display;
+
+// ==================== VARIÁVEIS DE ESTADO ====================
+
+// Calibração do sensor (padrão do perfil, recalibre pelo menu se necessário)
+int ADC_DRY = PERFIL.adcSeco;
+int ADC_WET = PERFIL.adcMolhado;
+
+// Estado do sistema
+float setpoint = 50.0;
+float umidade = 0.0;
+bool bombaLigada = false;
+bool displayPresente = false;   // Painel detectado no I2C e inicializado
+
+// Controle não-bloqueante
+unsigned long lastSensorRead = 0;
+unsigned long lastDisplayProbe = 0;
+uint8_t falhasDisplay = 0;      // Envios seguidos do framebuffer que falharam
+constexpr unsigned long SENSOR_INTERVAL = PERFIL.intervaloSensor;  // 2s no lab111
+
+// Tempo de execução do loop (sem o delay), para comparar perfis
+unsigned long loopSomaUs = 0;
+unsigned long loopMaxUs = 0;
+unsigned long loopAmostras = 0;
+
+// Latência tecla -> tela atualizada (motor de menus)
+unsigned long teclaSomaUs = 0;
+unsigned long teclaMaxUs = 0;
+unsigned long teclaAmostras = 0;
+
+// Tempo gasto compondo e enviando telas (cai a ~0 com o painel dormindo)
+unsigned long telaSomaUs = 0;
+unsigned long telaQuadros = 0;
+
+// Energia do painel (ver INTERFACE OLED)
+enum EstadoPainel : uint8_t { PAINEL_ACESO, PAINEL_ESCURO, PAINEL_DORMINDO };
+EstadoPainel estadoPainel = PAINEL_ACESO;
+unsigned long ultimaAtividadeTela = 0;   // millis() da última tecla (ou do boot)
+
+// Menu e telas
+Tela telaAtual = TELA_PRINCIPAL;
+
+// Filtro de leitura (logica.h), especializado em compilação pelo tipo do perfil
+FiltroLeitura<PERFIL.filtro, PERFIL.janelaFiltro> filtroSolo;
+
+// ==================== PROTÓTIPOS ====================
+void atualizarTela();
+extern char dispositivoId[16];
+void iniciarRajadaRede();
+void terminarRajadaRede();
+
+// ==================== ORÇAMENTO DE MEMÓRIA ====================
+// Pico de heap por subsistema (diferença do heap livre entre o início da
+// operação e amostras dentro dela) e folga mínima de pilha por tarefa. Outras
+// tarefas também alocam, então os valores são aproximados; servem para achar
+// quem ainda aloca em regime e para avisar quando um orçamento estoura.
+// O orçamento estático (RAM/flash por módulo) é verificado no build por
+// scripts/relatorio_memoria.py.
+
+#define PILHA_FOLGA_MIN  512   // Bytes livres mínimos aceitáveis em cada pilha
+
+enum Subsistema { MEM_DISPLAY, MEM_CAPTURA, MEM_ENVIO, MEM_WEB, MEM_N };
+struct OrcamentoMemoria {
+  const char* nome;
+  uint32_t orcamento;    // Bytes de heap permitidos por operação
+  uint32_t pico = 0;
+  bool estourou = false;
+};
+OrcamentoMemoria orcamentos[MEM_N] = {
+  {"display", 2304},     // Framebuffer 128x64 + cópia do painel (alocados uma vez)
+  {"captura", 28000},    // Buffers da captura (alocados uma vez) + envio
+  {"envio",   4096},     // Socket lwIP por rodada de uplink (buffers estáticos)
+  {"web",     8192},     // Por requisição do dashboard local
+};
+
+TaskHandle_t tarefaCapturaHandle = nullptr;
+TaskHandle_t tarefaUplinkHandle = nullptr;
+
+void medirHeap(Subsistema sub, uint32_t livreInicio) {
+  uint32_t livre = ESP.getFreeHeap();
+  if (livre >= livreInicio) return;
+
+  OrcamentoMemoria& o = orcamentos[sub];
+  uint32_t uso = livreInicio - livre;
+  if (uso <= o.pico) return;
+  o.pico = uso;
+  if (uso > o.orcamento && !o.estourou) {
+    o.estourou = true;
+    Serial.printf("ORCAMENTO: %s usou %u bytes de heap (limite %u)\n", o.nome, uso, o.orcamento);
+  }
+}
+
+void relatorioMemoria() {
+  Serial.printf("HEAP livre=%u min=%u maior bloco=%u |", ESP.getFreeHeap(), ESP.getMinFreeHeap(), ESP.getMaxAllocHeap());
+  for (int i = 0; i < MEM_N; i++) {
+    Serial.printf(" %s=%u/%u%s", orcamentos[i].nome, orcamentos[i].pico, orcamentos[i].orcamento,
+                  orcamentos[i].estourou ? "!" : "");
+  }
+  Serial.println();
+
+  // Folga de pilha (o ESP-IDF conta em bytes); o relatório roda na tarefa do loop
+  struct { const char* nome; TaskHandle_t t; } tarefas[] = {
+    {"loop", xTaskGetCurrentTaskHandle()},
+    {"captura", tarefaCapturaHandle},
+    {"uplink", tarefaUplinkHandle},
+    {"async_tcp", TEM_PAINEL_LOCAL ? xTaskGetHandle("async_tcp") : nullptr},
+  };
+  Serial.print("PILHA livre:");
+  for (auto& t : tarefas) {
+    if (t.t == nullptr) continue;   // Tarefa não existe neste perfil
+    UBaseType_t folga = uxTaskGetStackHighWaterMark(t.t);
+    Serial.printf(" %s=%u%s", t.nome, (unsigned)folga, folga < PILHA_FOLGA_MIN ? "!" : "");
+  }
+  Serial.println();
+}
+
+// ==================== SENSOR AMBIENTE (SHT3x) ====================
+// Temperatura/umidade do ar no mesmo I2C do OLED. Medição single-shot sem
+// clock stretching: comando agora, leitura >= 16 ms depois em outra volta do
+// loop, então nenhuma transação espera pelo sensor. O passo só roda em voltas
+// do loop sem flush do display, e cada transação dura poucas centenas de us.
+
+#define SHT3X_ADDR            0x44
+#define AMBIENTE_INTERVAL     10000   // Uma medição a cada 10s
+#define AMBIENTE_CONVERSAO_MS 16      // Tempo de conversão (alta repetibilidade)
+#define AMBIENTE_VALIDADE     60000   // Medição mais velha que isso não compensa nada
+
+// Compensação térmica do sensor capacitivo: contagens de ADC por °C acima de T_REF
+#define TEMP_REF_C            25.0
+#define TEMP_COEF_ADC_C       -4.0
+
+enum EstadoAmbiente : uint8_t { AMB_AUSENTE, AMB_OCIOSO, AMB_MEDINDO };
+EstadoAmbiente estadoAmbiente = AMB_AUSENTE;
+unsigned long ambienteComandoMs = 0;
+unsigned long ultimaMedicaoAmbiente = 0;   // Último comando de medição
+unsigned long ultimaLeituraAmbiente = 0;   // Última leitura com CRC válido
+bool ambienteValido = false;
+float temperaturaAr = 0;
+float umidadeAr = 0;
+bool i2cUsadoNesteLoop = false;   // O display já ocupou o barramento nesta volta
+
+// CRC-8 do SHT3x (polinômio 0x31, início 0xFF)
+uint8_t crcSht3x(const uint8_t* dados, int len) {
+  uint8_t crc = 0xFF;
+  for (int i = 0; i < len; i++) {
+    crc ^= dados[i];
+    for (int b = 0; b < 8; b++) {
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x31 : (crc << 1);
+    }
+  }
+  return crc;
+}
+
+bool comandoSht3x(uint16_t cmd) {
+  Wire.beginTransmission(SHT3X_ADDR);
+  Wire.write(cmd >> 8);
+  Wire.write(cmd & 0xFF);
+  return Wire.endTransmission() == 0;
+}
+
+void iniciarSensorAmbiente() {
+  if constexpr (!TEM_AMBIENTE) return;
+  // Soft reset também serve de detecção (ACK no endereço)
+  estadoAmbiente = comandoSht3x(0x30A2) ? AMB_OCIOSO : AMB_AUSENTE;
+  Serial.println(estadoAmbiente == AMB_AUSENTE ? "Sensor ambiente ausente" : "Sensor ambiente SHT3x detectado");
+}
+
+// Um passo da máquina de estados; chamado a cada volta do loop
+void passoSensorAmbiente(unsigned long now) {
+  if constexpr (!TEM_AMBIENTE) return;
+  if (estadoAmbiente == AMB_AUSENTE || i2cUsadoNesteLoop) return;
+
+  if (estadoAmbiente == AMB_OCIOSO) {
+    if (now - ultimaMedicaoAmbiente >= AMBIENTE_INTERVAL) {
+      ultimaMedicaoAmbiente = now;
+      if (comandoSht3x(0x2400)) {   // Single shot, alta repetibilidade, sem stretching
+        ambienteComandoMs = now;
+        estadoAmbiente = AMB_MEDINDO;
+      }
+    }
+  } else if (now - ambienteComandoMs >= AMBIENTE_CONVERSAO_MS) {
+    estadoAmbiente = AMB_OCIOSO;
+    uint8_t d[6];
+    if (Wire.requestFrom((uint8_t)SHT3X_ADDR, (uint8_t)6) != 6) return;
+    for (int i = 0; i < 6; i++) d[i] = Wire.read();
+    if (crcSht3x(d, 2) != d[2] || crcSht3x(d + 3, 2) != d[5]) return;
+
+    temperaturaAr = -45.0 + 175.0 * ((d[0] << 8) | d[1]) / 65535.0;
+    umidadeAr = 100.0 * ((d[3] << 8) | d[4]) / 65535.0;
+    ambienteValido = true;
+    ultimaLeituraAmbiente = now;
+  }
+
+  if (ambienteValido && now - ultimaLeituraAmbiente > AMBIENTE_VALIDADE) {
+    ambienteValido = false;   // Sensor parou de responder: sem compensação
+  }
+}
+
+// ==================== ALIMENTAÇÃO DA SONDA ====================
+// Com PERFIL.pinoSonda a sonda só fica alimentada enquanto alguém a usa: a
+// leitura periódica liga PERFIL.estabilizacaoSonda ms antes do horário e
+// desliga logo depois; a captura rápida (janela "pré" contínua) e as telas de
+// calibração a mantêm ligada enquanto duram. Menos corrente em repouso e menos
+// corrosão dos eletrodos. Sem pino, tudo aqui vira no-op.
+
+enum UsoSonda : uint8_t { SONDA_LEITURA = 1, SONDA_CAPTURA = 2, SONDA_CALIBRACAO = 4 };
+
+volatile uint8_t usosSonda = 0;
+unsigned long sondaLigadaEm = 0;       // millis() da última vez que ligou (estabilização)
+unsigned long sondaContadaAte = 0;     // Até onde o tempo ligada já entrou na soma
+unsigned long sondaLigadaSomaMs = 0;   // Tempo ligada no período do relatório
+portMUX_TYPE muxSonda = portMUX_INITIALIZER_UNLOCKED;
+
+void iniciarSonda() {
+  if constexpr (!TEM_GATE_SONDA) return;
+  pinMode(PERFIL.pinoSonda, OUTPUT);
+  digitalWrite(PERFIL.pinoSonda, LOW);
+}
+
+// Marca/desmarca um uso; a sonda fica ligada enquanto houver algum
+void usarSonda(UsoSonda uso, bool usar) {
+  if constexpr (!TEM_GATE_SONDA) return;
+  portENTER_CRITICAL(&muxSonda);
+  uint8_t antes = usosSonda;
+  uint8_t depois = usar ? (antes | uso) : (antes & ~uso);
+  usosSonda = depois;
+  if (!antes && depois) {
+    sondaLigadaEm = sondaContadaAte = millis();
+    digitalWrite(PERFIL.pinoSonda, HIGH);
+  } else if (antes && !depois) {
+    digitalWrite(PERFIL.pinoSonda, LOW);
+    sondaLigadaSomaMs += millis() - sondaContadaAte;
+  }
+  portEXIT_CRITICAL(&muxSonda);
+}
+
+// Ligada há tempo suficiente para a leitura valer
+bool sondaEstavel(unsigned long now) {
+  if constexpr (!TEM_GATE_SONDA) return true;
+  return usosSonda && now - sondaLigadaEm >= PERFIL.estabilizacaoSonda;
+}
+
+// Leitura avulsa para calibração: liga (se preciso) e espera estabilizar.
+// Fica ligada até o loop ver que a tela de calibração foi fechada.
+int lerAdcCalibracao() {
+  if constexpr (TEM_GATE_SONDA) {
+    usarSonda(SONDA_CALIBRACAO, true);
+    while (!sondaEstavel(millis())) delay(1);
+  }
+  return analogRead(SOIL_PIN);
+}
+
+// ==================== FUNÇÕES DO SENSOR ====================
+
+// Conversão ADC para porcentagem com a calibração atual
+float adcToPct(int adc) {
+  // Compensação de temperatura aplicada à leitura antes da calibração
+  if (TEM_AMBIENTE && ambienteValido) {
+    adc -= (int)(TEMP_COEF_ADC_C * (temperaturaAr - TEMP_REF_C));
+  }
+  return adcToPct(adc, ADC_DRY, ADC_WET);
+}
+
+// Leitura do sensor com filtro
+float readSoilPct() {
+  int raw = analogRead(SOIL_PIN);
+  float pct = adcToPct(raw);
+  
+  return filtroSolo.aplicar(pct);
+}
+
+// Resumo das leituras filtradas entre dois envios (EstatisticaIntervalo, logica.h)
+EstatisticaIntervalo estatIntervalo;
+
+// ==================== ESTIMADOR DE SECAGEM ====================
+// Mínimos quadrados recursivos (RLS) com esquecimento sobre a umidade filtrada,
+// modelo u(t) = nivel + taxa*t (t em minutos). O referencial é levado ao
+// instante de cada leitura, então só há 2 parâmetros e a matriz P 2x2: memória
+// constante e algumas multiplicações por leitura. Só aprende com a bomba
+// desligada e a água já assentada; ao desligar a bomba o nível é reaprendido e
+// a taxa (propriedade do solo/clima) é mantida.
+
+#define SECAGEM_TAU_S          1800     // Memória do esquecimento (~30 min)
+#define SECAGEM_ASSENTAR_MS    300000   // Ignora 5 min após regar (infiltração)
+#define SECAGEM_MIN_AMOSTRAS   30       // Leituras desde o último reinício antes de prever
+#define SECAGEM_TAXA_MIN       0.005f   // %/min: mais lento que isso é "estável" (sem ETA)
+#define SECAGEM_P0             1000.0f  // Covariância inicial (pouca confiança)
+
+struct EstimadorSecagem {
+  static constexpr float LAMBDA = 1.0f - (float)PERFIL.intervaloSensor / 1000.0f / SECAGEM_TAU_S;
+  float nivel = 0;
+  float taxa = 0;                 // %/min (negativa = secando)
+  float p00 = SECAGEM_P0, p01 = 0, p11 = SECAGEM_P0;
+  unsigned long ultimo = 0;       // millis() da última leitura usada
+  unsigned long assentaAte = 0;
+  uint32_t amostras = 0;          // Desde o último reinício do nível
+
+  void adicionar(float u, unsigned long now) {
+    if ((long)(now - assentaAte) < 0) return;
+    if (amostras == 0) ultimo = now;
+
+    // Leva o modelo ao instante atual: nivel' = nivel + taxa*dt, P' = T P T'
+    float dt = (now - ultimo) / 60000.0f;
+    ultimo = now;
+    nivel += taxa * dt;
+    p00 += dt * (2 * p01 + dt * p11);
+    p01 += dt * p11;
+
+    // Atualização com phi = [1, 0]: k = P phi / (lambda + phi' P phi)
+    float den = LAMBDA + p00;
+    float k0 = p00 / den;
+    float k1 = p01 / den;
+    float erro = u - nivel;
+    nivel += k0 * erro;
+    taxa += k1 * erro;
+    p11 = (p11 - k1 * p01) / LAMBDA;
+    p01 = p01 * (1 - k0) / LAMBDA;
+    p00 = p00 * (1 - k0) / LAMBDA;
+    amostras++;
+  }
+
+  // Depois de regar: nível desconhecido, taxa e sua confiança preservadas
+  void reiniciarNivel(unsigned long now) {
+    p00 = SECAGEM_P0;
+    p01 = 0;
+    assentaAte = now + SECAGEM_ASSENTAR_MS;
+    amostras = 0;
+  }
+
+  bool confiavel() const {
+    return amostras >= SECAGEM_MIN_AMOSTRAS && taxa < -SECAGEM_TAXA_MIN;
+  }
+
+  // Minutos até a umidade cruzar o alvo (-1 sem estimativa confiável)
+  long etaMin(float alvo) const {
+    if (!confiavel()) return -1;
+    if (nivel <= alvo) return 0;
+    return (long)((nivel - alvo) / -taxa);
+  }
+};
+
+EstimadorSecagem estimadorSecagem;
+
+// ==================== ASSINATURA DO UPLINK (HMAC-SHA256) ====================
+// Alternativa barata ao TLS: chave própria do nó na NVS (namespace "uplink",
+// chave "hmac", gravada por scripts/provisionar_chave.py) e cada requisição
+// assinada sobre "dispositivo\nboot\nseq\ntimestamp\n" + corpo. O SHA-256 do
+// mbedTLS usa o acelerador do ESP32. O backend recusa assinatura inválida,
+// (boot, seq) repetido e timestamp fora da tolerância (0 = ainda sem NTP).
+// Sem chave provisionada o nó segue mandando o X-API-Key.
+
+#define HMAC_CHAVE_LEN  32
+#define EPOCH_VALIDA    1600000000UL   // Abaixo disso o relógio ainda não veio do NTP
+
+bool chaveProvisionada = false;
+uint32_t bootAssinatura = 0;       // Contador de boots na NVS: o seq recomeça a cada boot
+uint32_t seqAssinatura = 0;
+portMUX_TYPE muxAssinatura = portMUX_INITIALIZER_UNLOCKED;
+SemaphoreHandle_t travaHmac = nullptr;   // Uplink e captura assinam de tarefas diferentes
+mbedtls_md_context_t ctxHmac;            // Chave já carregada (ipad/opad); reset por requisição
+
+void carregarChaveHmac(const uint8_t* chave) {
+  if (!travaHmac) {
+    travaHmac = xSemaphoreCreateMutex();
+    mbedtls_md_init(&ctxHmac);
+    mbedtls_md_setup(&ctxHmac, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1);
+  }
+  mbedtls_md_hmac_starts(&ctxHmac, chave, HMAC_CHAVE_LEN);
+  chaveProvisionada = true;
+}
+
+void iniciarAssinatura() {
+  Preferences prefs;
+  if (!prefs.begin("uplink", false)) {
+    Serial.println("NVS indisponivel: uplink sem assinatura");
+    return;
+  }
+  uint8_t chave[HMAC_CHAVE_LEN];
+  bool temChave = prefs.getBytes("hmac", chave, sizeof(chave)) == sizeof(chave);
+  bootAssinatura = prefs.getUInt("boot", 0) + 1;
+  prefs.putUInt("boot", bootAssinatura);
+  prefs.end();
+
+  if (temChave) {
+    carregarChaveHmac(chave);
+    memset(chave, 0, sizeof(chave));
+    Serial.printf("Uplink assinado (HMAC-SHA256), boot %lu\n", (unsigned long)bootAssinatura);
+  } else {
+    Serial.println("Sem chave HMAC na NVS: uplink com X-API-Key");
+  }
+}
+
+// Assina com um contexto que já tem a chave e monta os cabeçalhos X-*.
+// Sem estado global além da identidade: a bancada usa com contexto próprio.
+size_t montarAssinatura(char* buf, size_t tam, mbedtls_md_context_t& ctx, uint32_t seq,
+                        unsigned long ts, const void* corpo, size_t tamCorpo) {
+  char prefixo[64];
+  int tamPrefixo = snprintf(prefixo, sizeof(prefixo), "%s\n%lu\n%lu\n%lu\n",
+                            dispositivoId, (unsigned long)bootAssinatura, (unsigned long)seq, ts);
+  uint8_t mac[32];
+  mbedtls_md_hmac_reset(&ctx);
+  mbedtls_md_hmac_update(&ctx, (const uint8_t*)prefixo, tamPrefixo);
+  mbedtls_md_hmac_update(&ctx, (const uint8_t*)corpo, tamCorpo);
+  mbedtls_md_hmac_finish(&ctx, mac);
+
+  char hex[sizeof(mac) * 2 + 1];
+  for (size_t i = 0; i < sizeof(mac); i++) {
+    snprintf(hex + 2 * i, 3, "%02x", mac[i]);
+  }
+  int n = snprintf(buf, tam,
+      "X-Dispositivo: %s\r\nX-Boot: %lu\r\nX-Seq: %lu\r\nX-Timestamp: %lu\r\nX-Assinatura: %s\r\n",
+      dispositivoId, (unsigned long)bootAssinatura, (unsigned long)seq, ts, hex);
+  return min((size_t)n, tam - 1);
+}
+
+// Cabeçalhos de autenticação de uma requisição, cada um terminado em \r\n
+size_t cabecalhosAutenticacao(char* buf, size_t tam, const void* corpo, size_t tamCorpo) {
+  if (!chaveProvisionada) {
+    int n = snprintf(buf, tam, "X-API-Key: %s\r\n", API_SECRET_KEY);
+    return min((size_t)n, tam - 1);
+  }
+
+  portENTER_CRITICAL(&muxAssinatura);
+  uint32_t seq = ++seqAssinatura;
+  portEXIT_CRITICAL(&muxAssinatura);
+  time_t agora = time(nullptr);
+  unsigned long ts = agora > (time_t)EPOCH_VALIDA ? (unsigned long)agora : 0;
+
+  xSemaphoreTake(travaHmac, portMAX_DELAY);
+  size_t n = montarAssinatura(buf, tam, ctxHmac, seq, ts, corpo, tamCorpo);
+  xSemaphoreGive(travaHmac);
+  return n;
+}
+
+// ==================== CLIENTE HTTP (lwIP, NÃO BLOQUEANTE) ====================
+// Substitui o HTTPClient: socket não bloqueante e select() com prazo para
+// conectar, escrever e para cada resposta. Um servidor travado custa no máximo
+// o prazo (não o timeout do TCP), várias requisições podem ir em pipeline na
+// mesma conexão e toda espera é interrompida por cancelarHttp.
+
+#define HTTP_CONECTAR_MS   3000
+#define HTTP_RESPOSTA_MS   5000    // Por resposta, contado a partir da anterior
+#define HTTP_FATIA_MS      100     // Granularidade do select (reação ao cancelamento)
+
+volatile bool cancelarHttp = false;   // WiFi caiu: aborta esperas em andamento
+
+struct ConexaoHttp {
+  int fd = -1;
+  char buf[512];    // Respostas; o que sobra é o começo da próxima (pipeline)
+  size_t len = 0;
+};
+
+// Resposta sem corpo (só o que o uplink usa). code <= 0: -1 prazo/cancelado,
+// -2 conexão fechada, -3 resposta inválida
+struct RespostaHttp {
+  int code;
+  uint32_t retryAfterS;
+  bool fechar;        // Servidor encerra a conexão depois desta resposta
+};
+
+void httpFechar(ConexaoHttp& c) {
+  if (c.fd >= 0) {
+    close(c.fd);
+    c.fd = -1;
+  }
+  c.len = 0;
+}
+
+// Espera o socket ficar pronto até o prazo (millis), em fatias curtas
+bool esperarSocket(int fd, bool escrita, unsigned long prazo) {
+  while (!cancelarHttp) {
+    long resta = (long)(prazo - millis());
+    if (resta <= 0) return false;
+    fd_set conjunto;
+    FD_ZERO(&conjunto);
+    FD_SET(fd, &conjunto);
+    timeval tv = { 0, (long)min<long>(resta, HTTP_FATIA_MS) * 1000 };
+    int r = select(fd + 1, escrita ? nullptr : &conjunto, escrita ? &conjunto : nullptr, nullptr, &tv);
+    if (r > 0) return true;
+    if (r < 0 && errno != EINTR) return false;
+  }
+  return false;
+}
+
+bool httpConectar(ConexaoHttp& c) {
+  httpFechar(c);
+  addrinfo dicas = {};
+  dicas.ai_family = AF_INET;
+  dicas.ai_socktype = SOCK_STREAM;
+  addrinfo* destino = nullptr;
+  char porta[8];
+  snprintf(porta, sizeof(porta), "%d", FASTAPI_PORT);
+  // FASTAPI_HOST é um IP literal: resolve sem consultar DNS
+  if (getaddrinfo(FASTAPI_HOST, porta, &dicas, &destino) != 0 || !destino) return false;
+
+  c.fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (c.fd < 0) {
+    freeaddrinfo(destino);
+    return false;
+  }
+  fcntl(c.fd, F_SETFL, fcntl(c.fd, F_GETFL, 0) | O_NONBLOCK);
+  int r = connect(c.fd, destino->ai_addr, destino->ai_addrlen);
+  freeaddrinfo(destino);
+  if (r == 0) return true;
+  if (errno != EINPROGRESS || !esperarSocket(c.fd, true, millis() + HTTP_CONECTAR_MS)) {
+    httpFechar(c);
+    return false;
+  }
+  int erro = 0;
+  socklen_t tam = sizeof(erro);
+  getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &erro, &tam);
+  if (erro) {
+    httpFechar(c);
+    return false;
+  }
+  return true;
+}
+
+bool httpEscrever(ConexaoHttp& c, const void* dados, size_t n, unsigned long prazo) {
+  const uint8_t* p = (const uint8_t*)dados;
+  while (n > 0) {
+    int w = send(c.fd, p, n, 0);
+    if (w > 0) {
+      p += w;
+      n -= w;
+    } else if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      if (!esperarSocket(c.fd, true, prazo)) return false;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Cabeçalho de um POST (já autenticado para este corpo); o corpo segue com httpEscrever
+size_t httpCabecalho(char* buf, size_t tam, const char* caminho, const char* tipo,
+                     const void* corpo, size_t tamCorpo, const char* extras) {
+  char autenticacao[224];
+  cabecalhosAutenticacao(autenticacao, sizeof(autenticacao), corpo, tamCorpo);
+  int n = snprintf(buf, tam,
+      "POST %s HTTP/1.1\r\nHost: %s:%d\r\nContent-Type: %s\r\nContent-Length: %u\r\n%s%s\r\n",
+      caminho, FASTAPI_HOST, FASTAPI_PORT, tipo, (unsigned)tamCorpo, autenticacao, extras ? extras : "");
+  return min((size_t)n, tam - 1);
+}
+
+// Lê mais bytes para c.buf (até "max"); false em prazo, cancelamento ou fim da conexão
+bool httpReceber(ConexaoHttp& c, size_t max, unsigned long prazo, RespostaHttp& r) {
+  for (;;) {
+    int n = recv(c.fd, c.buf + c.len, max, 0);
+    if (n > 0) {
+      c.len += n;
+      return true;
+    }
+    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+      r.code = -2;
+      return false;
+    }
+    if (!esperarSocket(c.fd, false, prazo)) {
+      r.code = -1;
+      return false;
+    }
+  }
+}
+
+// Lê uma resposta inteira (status, cabeçalhos e corpo) até o prazo; o corpo é
+// copiado para "destino" até caber (terminado em '\0') e o resto descartado.
+// Bytes excedentes ficam no buffer para a resposta seguinte do pipeline.
+RespostaHttp httpLerResposta(ConexaoHttp& c, unsigned long prazo,
+                             char* destino = nullptr, size_t tamDestino = 0) {
+  RespostaHttp r = { -1, 0, false };
+  char* fimCabecalho;
+  for (;;) {
+    c.buf[c.len] = '\0';
+    fimCabecalho = strstr(c.buf, "\r\n\r\n");
+    if (fimCabecalho) break;
+    if (c.len >= sizeof(c.buf) - 1) {
+      r.code = -3;
+      return r;
+    }
+    if (!httpReceber(c, sizeof(c.buf) - 1 - c.len, prazo, r)) return r;
+  }
+
+  int code = 0;
+  if (sscanf(c.buf, "HTTP/1.%*d %d", &code) != 1) {
+    r.code = -3;
+    return r;
+  }
+  long corpo = -1;
+  *fimCabecalho = '\0';
+  for (char* linha = strstr(c.buf, "\r\n"); linha; linha = strstr(linha + 2, "\r\n")) {
+    const char* campo = linha + 2;
+    if (strncasecmp(campo, "Content-Length:", 15) == 0) corpo = atol(campo + 15);
+    else if (strncasecmp(campo, "Retry-After:", 12) == 0) r.retryAfterS = atol(campo + 12);
+    else if (strncasecmp(campo, "Connection:", 11) == 0 && strstr(campo, "close")) r.fechar = true;
+  }
+  if (corpo < 0) r.fechar = true;   // Sem tamanho (chunked/até fechar): não reaproveita
+
+  // Consome o corpo, preservando o que já for da próxima resposta
+  size_t usados = fimCabecalho + 4 - c.buf;
+  size_t falta = corpo > 0 ? corpo : 0;
+  size_t copiados = 0;
+  for (;;) {
+    size_t trecho = min(c.len - usados, falta);
+    if (destino && copiados + 1 < tamDestino) {
+      size_t n = min(trecho, tamDestino - 1 - copiados);
+      memcpy(destino + copiados, c.buf + usados, n);
+      copiados += n;
+    }
+    usados += trecho;
+    falta -= trecho;
+    if (falta == 0) break;
+    c.len = usados = 0;
+    if (!httpReceber(c, min(falta, sizeof(c.buf) - 1), prazo, r)) return r;
+  }
+  if (destino && tamDestino) destino[copiados] = '\0';
+  memmove(c.buf, c.buf + usados, c.len - usados);
+  c.len -= usados;
+  r.code = code;
+  return r;
+}
+
+// ==================== CAPTURA RÁPIDA (DIAGNÓSTICO) ====================
+// Grava o ADC bruto a CAPTURA_TAXA_HZ numa janela em torno de liga/desliga da
+// bomba e envia um blob comprimido para /api/captura. Tudo roda numa tarefa
+// própria no core 0: o loop (sensor, teclado, controle) não espera por ela.
+
+#define CAPTURA_TAXA_HZ   200
+#define CAPTURA_PRE_MS    2000     // Janela antes do evento
+#define CAPTURA_POS_MS    30000    // Janela depois do evento
+#define CAPTURA_STACK     6144
+
+constexpr uint32_t CAPTURA_PERIODO_MS = 1000 / CAPTURA_TAXA_HZ;
+constexpr size_t CAPTURA_PRE   = (size_t)CAPTURA_TAXA_HZ * CAPTURA_PRE_MS / 1000;
+constexpr size_t CAPTURA_TOTAL = (size_t)CAPTURA_TAXA_HZ * (CAPTURA_PRE_MS + CAPTURA_POS_MS) / 1000;
+// ADC de 12 bits: delta zigzag < 2^14, cabe em 2 bytes de varint
+constexpr size_t CAPTURA_BLOB_MAX = CAPTURA_TOTAL * 2;
+
+enum EventoCaptura : uint8_t { CAPTURA_NENHUM, CAPTURA_LIGA, CAPTURA_DESLIGA };
+
+uint16_t* capturaAmostras = nullptr;   // Buffer circular (PSRAM se houver)
+uint8_t* capturaBlob = nullptr;        // Saída comprimida
+volatile EventoCaptura capturaPedido = CAPTURA_NENHUM;  // Escrito pelo loop, lido pela tarefa
+
+// Pede uma captura; ignorado se outra já está em andamento
+void dispararCaptura(EventoCaptura evento) {
+  if constexpr (!TEM_CAPTURA) return;
+  if (capturaAmostras && capturaPedido == CAPTURA_NENHUM) {
+    capturaPedido = evento;
+  }
+}
+
+// Delta + zigzag + varint: amostras vizinhas quase iguais viram 1 byte
+size_t comprimirCaptura(size_t inicio, size_t n, uint8_t* saida) {
+  size_t len = 0;
+  int32_t anterior = 0;
+  for (size_t i = 0; i < n; i++) {
+    int32_t v = capturaAmostras[(inicio + i) % CAPTURA_TOTAL];
+    int32_t d = v - anterior;
+    anterior = v;
+    uint32_t z = ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+    while (z >= 0x80) {
+      saida[len++] = (z & 0x7F) | 0x80;
+      z >>= 7;
+    }
+    saida[len++] = z;
+  }
+  return len;
+}
+
+bool enviarCaptura(EventoCaptura evento, size_t pre, size_t n, size_t len) {
+  if (WiFi.status() != WL_CONNECTED) return false;
+
+  uint32_t heapInicio = ESP.getFreeHeap();
+  char extras[128];
+  snprintf(extras, sizeof(extras),
+           "X-Captura-Evento: %s\r\nX-Captura-Taxa: %d\r\nX-Captura-Pre: %u\r\nX-Captura-Amostras: %u\r\n",
+           evento == CAPTURA_LIGA ? "liga" : "desliga", CAPTURA_TAXA_HZ, (unsigned)pre, (unsigned)n);
+  static char cabecalho[512];
+  size_t tamCabecalho = httpCabecalho(cabecalho, sizeof(cabecalho), "/api/captura",
+                                      "application/octet-stream", capturaBlob, len, extras);
+
+  static ConexaoHttp conexao;
+  int code = -2;
+  iniciarRajadaRede();
+  if (httpConectar(conexao)) {
+    unsigned long prazo = millis() + HTTP_RESPOSTA_MS;
+    if (httpEscrever(conexao, cabecalho, tamCabecalho, prazo) &&
+        httpEscrever(conexao, capturaBlob, len, prazo)) {
+      code = httpLerResposta(conexao, millis() + HTTP_RESPOSTA_MS).code;
+    }
+    httpFechar(conexao);
+  }
+  terminarRajadaRede();
+  medirHeap(MEM_CAPTURA, heapInicio);
+  Serial.printf("Captura enviada: %u amostras, %u bytes. Code: %d\n", (unsigned)n, (unsigned)len, code);
+  return code == 200 || code == 201;
+}
+
+// Amostragem contínua num buffer circular (janela "pré"); no disparo completa
+// a janela "pós", comprime direto do buffer, envia e rearma.
+void tarefaCaptura(void*) {
+  size_t pos = 0;           // Próxima escrita no buffer circular
+  size_t preenchidas = 0;   // Amostras válidas no buffer
+  size_t restantes = 0;     // Amostras "pós" que faltam (0 = aguardando disparo)
+  size_t preDisparo = 0;
+  usarSonda(SONDA_CAPTURA, true);   // Buffer "pré" contínuo: sonda sempre ligada
+  vTaskDelay(pdMS_TO_TICKS(PERFIL.estabilizacaoSonda));
+  TickType_t proximo = xTaskGetTickCount();
+
+  for (;;) {
+    vTaskDelayUntil(&proximo, pdMS_TO_TICKS(CAPTURA_PERIODO_MS));
+
+    capturaAmostras[pos] = analogRead(SOIL_PIN);
+    pos = (pos + 1) % CAPTURA_TOTAL;
+    if (preenchidas < CAPTURA_TOTAL) preenchidas++;
+
+    EventoCaptura evento = capturaPedido;
+    if (evento == CAPTURA_NENHUM) continue;
+
+    if (restantes == 0) {
+      // Disparo: o que já está no buffer vira a janela "pré"
+      preDisparo = min(preenchidas, CAPTURA_PRE);
+      restantes = CAPTURA_TOTAL - CAPTURA_PRE;
+      continue;
+    }
+    if (--restantes > 0) continue;
+
+    size_t n = preDisparo + (CAPTURA_TOTAL - CAPTURA_PRE);
+    size_t inicio = (pos + CAPTURA_TOTAL - n) % CAPTURA_TOTAL;
+    size_t len = comprimirCaptura(inicio, n, capturaBlob);
+    enviarCaptura(evento, preDisparo, n, len);
+
+    // Rearma: a janela "pré" recomeça do zero depois do envio
+    preenchidas = 0;
+    capturaPedido = CAPTURA_NENHUM;
+    proximo = xTaskGetTickCount();
+  }
+}
+
+void iniciarCaptura() {
+  if constexpr (!TEM_CAPTURA) return;
+
+  uint32_t heapInicio = ESP.getFreeHeap();
+  size_t bytesAmostras = CAPTURA_TOTAL * sizeof(uint16_t);
+  if (psramFound()) {
+    capturaAmostras = (uint16_t*)ps_malloc(bytesAmostras);
+    capturaBlob = (uint8_t*)ps_malloc(CAPTURA_BLOB_MAX);
+  } else {
+    capturaAmostras = (uint16_t*)malloc(bytesAmostras);
+    capturaBlob = (uint8_t*)malloc(CAPTURA_BLOB_MAX);
+  }
+  if (!capturaAmostras || !capturaBlob) {
+    Serial.println("Captura rapida desativada: memoria insuficiente");
+    free(capturaAmostras);
+    free(capturaBlob);
+    capturaAmostras = nullptr;
+    capturaBlob = nullptr;
+    return;
+  }
+
+  medirHeap(MEM_CAPTURA, heapInicio);
+
+  // Prioridade baixa no core 0; o loop do Arduino fica no core 1
+  xTaskCreatePinnedToCore(tarefaCaptura, "captura", CAPTURA_STACK, nullptr, 1, &tarefaCapturaHandle, 0);
+}
+
+// ==================== FUNÇÕES DA BOMBA ====================
+
+void ligarBomba() {
+  if (!bombaLigada) {
+    digitalWrite(LED_PIN, HIGH);
+    bombaLigada = true;
+    dispararCaptura(CAPTURA_LIGA);
+    Serial.println("BOMBA LIGADA");
+  }
+}
+
+void desligarBomba() {
+  if (bombaLigada) {
+    digitalWrite(LED_PIN, LOW);
+    bombaLigada = false;
+    estimadorSecagem.reiniciarNivel(millis());
+    dispararCaptura(CAPTURA_DESLIGA);
+    Serial.println("BOMBA DESLIGADA");
+  }
+}
+
+// ==================== GERENCIAMENTO DE ENERGIA ====================
+
+// Estados de consumo: OCIOSO = delay do loop (CPU parada, modem sleep),
+// ATIVO = sensor/teclado/tela a 80 MHz, REDE = conexão WiFi a 240 MHz. O loop
+// informa o que está fazendo; rodadas de rede das tarefas de uplink e captura
+// têm precedência enquanto duram (o loop segue rodando, mas o rádio e o clock
+// alto dominam o consumo).
+enum EstadoEnergia { ENERGIA_OCIOSO, ENERGIA_ATIVO, ENERGIA_REDE, ENERGIA_N_ESTADOS };
+const char* NOMES_ENERGIA[ENERGIA_N_ESTADOS] = { "ocioso", "ativo", "rede" };
+const float CORRENTES_ENERGIA[ENERGIA_N_ESTADOS] = { CORRENTE_OCIOSO_MA, CORRENTE_ATIVO_MA, CORRENTE_REDE_MA };
+
+EstadoEnergia estadoEnergia = ENERGIA_ATIVO;  // Estado efetivo sendo contabilizado
+EstadoEnergia estadoLoop = ENERGIA_ATIVO;     // O que o loop está fazendo
+uint8_t rajadasRede = 0;                      // Rodadas de rede em andamento nas tarefas
+unsigned long inicioEstadoEnergia = 0;        // micros() da última transição
+uint64_t tempoEstadoUs[ENERGIA_N_ESTADOS] = {0};
+unsigned long lastRelatorioEnergia = 0;
+portMUX_TYPE muxEnergia = portMUX_INITIALIZER_UNLOCKED;
+SemaphoreHandle_t travaClock = nullptr;       // setCpuFrequencyMhz vem de tarefas diferentes
+#ifdef ENERGIA_LIGHT_SLEEP
+esp_pm_lock_handle_t lockRede = nullptr;      // Clock máximo durante as rodadas de rede
+#endif
+
+// Fecha a contagem do estado efetivo até agora e recalcula-o (com muxEnergia)
+void contabilizarEnergia() {
+  unsigned long agora = micros();
+  tempoEstadoUs[estadoEnergia] += agora - inicioEstadoEnergia;
+  inicioEstadoEnergia = agora;
+  estadoEnergia = rajadasRede ? ENERGIA_REDE : estadoLoop;
+}
+
+// Clock conforme o estado efetivo. Com ENERGIA_LIGHT_SLEEP o DFS do esp_pm
+// cuida do clock; as rodadas de rede seguram lockRede.
+void ajustarClock() {
+#ifndef ENERGIA_LIGHT_SLEEP
+  if (!travaClock) {
+    travaClock = xSemaphoreCreateMutex();   // Primeira chamada vem do setup, antes das tarefas
+  }
+  xSemaphoreTake(travaClock, portMAX_DELAY);
+  portENTER_CRITICAL(&muxEnergia);
+  uint32_t mhz = (estadoEnergia == ENERGIA_REDE) ? CPU_MHZ_REDE : CPU_MHZ_OCIOSO;
+  portEXIT_CRITICAL(&muxEnergia);
+  if (getCpuFrequencyMhz() != mhz) {
+    setCpuFrequencyMhz(mhz);
+  }
+  xSemaphoreGive(travaClock);
+#endif
+}
+
+// Troca de estado do loop: contabiliza o tempo do estado anterior e ajusta o clock
+void entrarEstadoEnergia(EstadoEnergia novo) {
+  portENTER_CRITICAL(&muxEnergia);
+  EstadoEnergia antes = estadoEnergia;
+  estadoLoop = novo;
+  contabilizarEnergia();
+  bool mudou = estadoEnergia != antes;
+  portEXIT_CRITICAL(&muxEnergia);
+  if (mudou) ajustarClock();
+}
+
+// Rodada de rede de uma tarefa (uplink, captura): conta como REDE e sobe o clock
+void iniciarRajadaRede() {
+  portENTER_CRITICAL(&muxEnergia);
+  contabilizarEnergia();
+  rajadasRede++;
+  contabilizarEnergia();
+  portEXIT_CRITICAL(&muxEnergia);
+#ifdef ENERGIA_LIGHT_SLEEP
+  if (lockRede) esp_pm_lock_acquire(lockRede);
+#endif
+  ajustarClock();
+}
+
+void terminarRajadaRede() {
+  portENTER_CRITICAL(&muxEnergia);
+  contabilizarEnergia();
+  rajadasRede--;
+  contabilizarEnergia();
+  portEXIT_CRITICAL(&muxEnergia);
+#ifdef ENERGIA_LIGHT_SLEEP
+  if (lockRede) esp_pm_lock_release(lockRede);
+#endif
+  ajustarClock();
+}
+
+// Configura o WiFi já com o listen interval (só vale na associação) e conecta.
+void iniciarWiFiEconomico() {
+  WiFi.mode(WIFI_STA);
+
+  wifi_config_t cfg = {};
+  strncpy((char*)cfg.sta.ssid, ssid, sizeof(cfg.sta.ssid));
+  strncpy((char*)cfg.sta.password, password, sizeof(cfg.sta.password));
+  cfg.sta.listen_interval = WIFI_LISTEN_INTERVAL;
+  esp_wifi_set_config(WIFI_IF_STA, &cfg);
+
+  WiFi.begin(); // Conecta com a configuração acima
+}
+
+// Modem sleep entre envios e, opcionalmente, light sleep automático no delay do loop.
+void configurarEnergia() {
+  if constexpr (TEM_WIFI) {
+    WiFi.setSleep(WIFI_PS_MAX_MODEM);
+  }
+
+#ifdef ENERGIA_LIGHT_SLEEP
+  esp_pm_config_esp32_t pm = {};
+  pm.max_freq_mhz = CPU_MHZ_REDE;
+  pm.min_freq_mhz = CPU_MHZ_OCIOSO;
+  pm.light_sleep_enable = true;
+  if (esp_pm_configure(&pm) != ESP_OK) {
+    Serial.println("Light sleep automatico indisponivel (CONFIG_PM_ENABLE?)");
+  } else {
+    esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "rede", &lockRede);
+  }
+#endif
+
+  entrarEstadoEnergia(ENERGIA_ATIVO);
+}
+
+// Relatório periódico: fração de tempo por estado, corrente média e autonomia estimada.
+void relatorioEnergia() {
+  uint64_t tempos[ENERGIA_N_ESTADOS];
+  portENTER_CRITICAL(&muxEnergia);
+  contabilizarEnergia();   // Fecha a contagem do estado corrente
+  memcpy(tempos, tempoEstadoUs, sizeof(tempos));
+  portEXIT_CRITICAL(&muxEnergia);
+
+  uint64_t total = 0;
+  for (int i = 0; i < ENERGIA_N_ESTADOS; i++) total += tempos[i];
+  if (total == 0) return;
+
+  float correnteMedia = 0;
+  Serial.print("ENERGIA:");
+  for (int i = 0; i < ENERGIA_N_ESTADOS; i++) {
+    float frac = (float)tempos[i] / (float)total;
+    correnteMedia += frac * CORRENTES_ENERGIA[i];
+    Serial.printf(" %s=%.2f%%", NOMES_ENERGIA[i], frac * 100.0);
+  }
+  Serial.printf(" | media=%.1f mA | autonomia=%.1f h\n", correnteMedia, BATERIA_MAH / correnteMedia);
+}
+
+// Relatório do perfil: tempo do loop no período e heap, zerando as estatísticas
+void relatorioPerfil() {
+  if (loopAmostras == 0) return;
+  Serial.printf("PERFIL %s: loop medio=%lu us max=%lu us (%lu iteracoes) | heap livre=%u min=%u\n",
+                PERFIL.nome, loopSomaUs / loopAmostras, loopMaxUs, loopAmostras,
+                ESP.getFreeHeap(), ESP.getMinFreeHeap());
+  loopSomaUs = 0;
+  loopMaxUs = 0;
+  loopAmostras = 0;
+
+  if (teclaAmostras > 0) {
+    Serial.printf("TECLADO: tecla->tela medio=%lu us max=%lu us (%lu teclas)\n",
+                  teclaSomaUs / teclaAmostras, teclaMaxUs, teclaAmostras);
+    teclaSomaUs = 0;
+    teclaMaxUs = 0;
+    teclaAmostras = 0;
+  }
+
+  if constexpr (TEM_DISPLAY) {
+    static const char* NOMES_PAINEL[] = { "aceso", "escuro", "dormindo" };
+    Serial.printf("TELA: %s, %lu quadros, render=%lu us no periodo (%lu ms/h)\n",
+                  NOMES_PAINEL[estadoPainel], telaQuadros, telaSomaUs,
+                  (unsigned long)((uint64_t)telaSomaUs * 3600 / RELATORIO_ENERGIA_INTERVAL));
+    telaSomaUs = 0;
+    telaQuadros = 0;
+  }
+
+  if constexpr (TEM_GATE_SONDA) {
+    portENTER_CRITICAL(&muxSonda);
+    unsigned long ligadaMs = sondaLigadaSomaMs;
+    if (usosSonda) {
+      unsigned long now = millis();
+      ligadaMs += now - sondaContadaAte;
+      sondaContadaAte = now;   // O restante conta no próximo período
+    }
+    sondaLigadaSomaMs = 0;
+    portEXIT_CRITICAL(&muxSonda);
+    Serial.printf("SONDA: ligada %.2f%% do periodo (GPIO%u, estabilizacao %u ms)\n",
+                  100.0 * ligadaMs / RELATORIO_ENERGIA_INTERVAL,
+                  PERFIL.pinoSonda, PERFIL.estabilizacaoSonda);
+  }
+
+  Serial.printf("SECAGEM: taxa=%.2f %%/h nivel=%.1f%% eta=%ld min (%lu amostras)\n",
+                estimadorSecagem.taxa * 60, estimadorSecagem.nivel,
+                estimadorSecagem.etaMin(setpoint), (unsigned long)estimadorSecagem.amostras);
+}
+
+// ==================== PARÂMETROS DE CONTROLE (AJUSTE DO BACKEND) ====================
+// O backend ajusta um modelo de resposta por canteiro e devolve, na resposta
+// do registro, pulso, zona morta e antecipação quando a versão informada pelo
+// nó ("cfg") está desatualizada. Escrito pela tarefa de uplink, lido pelo
+// controle no loop. Não persiste: depois de um boot o nó manda cfg=0 e recebe
+// os parâmetros de novo no primeiro envio.
+
+#define PREDITIVO_ANTECIPACAO_MIN  20
+#define PULSO_LIGADO_MS            15000
+
+struct ParametrosControle {
+  uint32_t versao = 0;                      // 0 = padrões do firmware
+  unsigned long pulsoMs = PULSO_LIGADO_MS;
+  float zonaMorta = 0;                      // % acima do alvo em que a rega contínua para
+  long antecipacaoMin = PREDITIVO_ANTECIPACAO_MIN;
+};
+
+ParametrosControle parametrosControle;
+portMUX_TYPE muxParametros = portMUX_INITIALIZER_UNLOCKED;
+
+ParametrosControle lerParametros() {
+  portENTER_CRITICAL(&muxParametros);
+  ParametrosControle p = parametrosControle;
+  portEXIT_CRITICAL(&muxParametros);
+  return p;
+}
+
+// Aplica o "config" de uma resposta do registro (limites do firmware por cima)
+void aplicarConfig(const char* corpo) {
+  StaticJsonDocument<384> doc;
+  if (deserializeJson(doc, corpo)) return;
+  JsonVariantConst cfg = doc["config"];
+  if (cfg.isNull()) return;
+
+  ParametrosControle p;
+  p.versao = cfg["versao"] | 0u;
+  p.pulsoMs = constrain(cfg["pulso_ms"] | (unsigned long)PULSO_LIGADO_MS, 3000UL, 120000UL);
+  p.zonaMorta = constrain(cfg["zona_morta"] | 0.0f, 0.0f, 10.0f);
+  p.antecipacaoMin = constrain(cfg["antecipacao_min"] | (long)PREDITIVO_ANTECIPACAO_MIN, 5L, 120L);
+  portENTER_CRITICAL(&muxParametros);
+  parametrosControle = p;
+  portEXIT_CRITICAL(&muxParametros);
+  Serial.printf("Controle v%lu: pulso=%lu ms zona morta=%.1f%% antecipacao=%ld min\n",
+                (unsigned long)p.versao, p.pulsoMs, p.zonaMorta, p.antecipacaoMin);
+}
+
+// ==================== FUNÇÕES DE COMUNICAÇÃO (FastAPI) ====================
+
+#define PAYLOAD_MAX 384
+
+// Diagnóstico do uplink: número do lote (lacunas no servidor = lotes fundidos
+// na fila; repetidos = reenvio após prazo estourado) e pior tempo de loop do intervalo
+uint32_t seqEnvio = 0;
+unsigned long loopMaxEnvioUs = 0;
+
+// Identidade do nó: "esp32-XXXXXX" a partir do MAC; o hash do MAC é a
+// semente do jitter, então cada placa tem sua fase própria e reproduzível.
+char dispositivoId[16] = "";
+uint32_t hashDispositivo = 0;
+
+void iniciarIdentidade() {
+  uint64_t mac = ESP.getEfuseMac();
+  snprintf(dispositivoId, sizeof(dispositivoId), "esp32-%06X", (unsigned)((mac >> 24) & 0xFFFFFF));
+
+  // FNV-1a dos 6 bytes do MAC
+  hashDispositivo = 2166136261u;
+  for (int i = 0; i < 6; i++) {
+    hashDispositivo ^= (mac >> (8 * i)) & 0xFF;
+    hashDispositivo *= 16777619u;
+  }
+}
+
+// Fecha o intervalo num LoteEnvio (logica.h) com o estado do loop neste instante
+LoteEnvio capturarLote(const EstatisticaIntervalo& est, unsigned long now) {
+  LoteEnvio l;
+  l.est = est;
+  l.seq = ++seqEnvio;
+  l.criadoMs = now;
+  l.loopMaxUs = loopMaxEnvioUs;
+  l.temperaturaAr = temperaturaAr;
+  l.umidadeAr = umidadeAr;
+  l.taxa = estimadorSecagem.taxa;
+  l.etaMin = estimadorSecagem.etaMin(setpoint);
+  l.ambiente = ambienteValido;
+  l.secagem = estimadorSecagem.confiavel();
+  l.display = displayPresente;
+  l.bomba = bombaLigada;
+  loopMaxEnvioUs = 0;
+  return l;
+}
+
+// Payload do lote (logica.h); a idade e a versão dos parâmetros são da hora do envio
+size_t montarPayload(char* buf, size_t tam, const LoteEnvio& l, unsigned long now) {
+  return montarPayload(buf, tam, l, dispositivoId, now - l.criadoMs, lerParametros().versao);
+}
+
+// ==================== AGENDADOR DE ENVIO ====================
+// Evita que a frota inteira (que volta junto depois de uma queda de energia)
+// feche e poste lotes na mesma fase: fase inicial e jitter por ciclo derivados
+// do MAC. Backoff e Retry-After ficam com a tarefa de uplink (abaixo).
+
+#define JITTER_FRACAO   10        // Jitter por ciclo: até 1/10 do intervalo
+#define BACKOFF_MAX_MS  600000    // Espera máxima após falhas seguidas (10 min)
+
+unsigned long proximoEnvio = 0;
+uint32_t cicloEnvio = 0;
+
+// Jitter determinístico: hash do MAC misturado ao número do ciclo
+unsigned long jitterDe(uint32_t ciclo) {
+  uint32_t x = hashDispositivo ^ (ciclo * 0x9E3779B9u);
+  x ^= x >> 16;
+  x *= 0x7FEB352Du;
+  x ^= x >> 15;
+  return x % (API_SEND_INTERVAL / JITTER_FRACAO + 1);
+}
+
+// Primeiro envio numa fase própria do dispositivo dentro do intervalo
+void iniciarAgendador(unsigned long now) {
+  proximoEnvio = now + hashDispositivo % API_SEND_INTERVAL;
+}
+
+void agendarProximoEnvio(unsigned long now) {
+  proximoEnvio = now + API_SEND_INTERVAL + jitterDe(++cicloEnvio);
+}
+
+// ==================== FILA DE ENVIO (TAREFA DE UPLINK) ====================
+// O loop só fecha o intervalo num LoteEnvio e o enfileira; uma tarefa própria
+// no core 0 envia a fila em pipeline (até PIPELINE_MAX POSTs na mesma conexão,
+// respostas lidas em ordem), cada resposta com prazo próprio. O lote cuja
+// resposta estoura o prazo vai para o fim da fila, para não segurar os outros
+// na próxima rodada. Fila cheia (backend fora por muito tempo): os dois lotes
+// mais antigos fora de voo são fundidos num só, sem perder leituras.
+
+#define FILA_ENVIO_LEN  8
+#define PIPELINE_MAX    4
+#define UPLINK_STACK    4096
+
+LoteEnvio filaEnvio[FILA_ENVIO_LEN];   // Buffer circular, protegido por muxFila
+uint8_t filaInicio = 0;
+uint8_t filaTam = 0;
+uint8_t filaEmVoo = 0;                 // Primeiros filaEmVoo lotes em uso pela tarefa
+uint32_t lotesFundidos = 0;
+uint8_t falhasSeguidas = 0;            // Rodadas seguidas sem nenhum lote confirmado
+portMUX_TYPE muxFila = portMUX_INITIALIZER_UNLOCKED;
+
+inline LoteEnvio& loteNaFila(uint8_t i) {
+  return filaEnvio[(filaInicio + i) % FILA_ENVIO_LEN];
+}
+
+// Remove o lote i da fila mantendo a ordem dos demais (chamar dentro de muxFila)
+void removerDaFila(uint8_t i) {
+  for (; i + 1 < filaTam; i++) {
+    loteNaFila(i) = loteNaFila(i + 1);
+  }
+  filaTam--;
+}
+
+void enfileirarLote(const LoteEnvio& lote) {
+  portENTER_CRITICAL(&muxFila);
+  if (filaTam == FILA_ENVIO_LEN) {
+    // O mais novo dos dois leva o resumo conjunto e fica no lugar do mais velho
+    uint8_t i = filaEmVoo;
+    const LoteEnvio& velho = loteNaFila(i);
+    LoteEnvio& novo = loteNaFila(i + 1);
+    EstatisticaIntervalo soma = velho.est;
+    soma.juntar(novo.est);
+    novo.est = soma;
+    novo.loopMaxUs = max(novo.loopMaxUs, velho.loopMaxUs);
+    removerDaFila(i);
+    lotesFundidos++;
+  }
+  loteNaFila(filaTam++) = lote;
+  portEXIT_CRITICAL(&muxFila);
+  if (tarefaUplinkHandle) xTaskNotifyGive(tarefaUplinkHandle);
+}
+
+void tarefaUplink(void*) {
+  static ConexaoHttp conexao;
+  static char cabecalho[384];
+  static char payload[PAYLOAD_MAX];
+  static char resposta[384];
+  static LoteEnvio voo[PIPELINE_MAX];
+  unsigned long retomarEm = millis();
+
+  for (;;) {
+    long espera = (long)(retomarEm - millis());
+    if (espera > 0) {
+      vTaskDelay(pdMS_TO_TICKS(espera));
+      continue;
+    }
+
+    uint8_t n;
+    portENTER_CRITICAL(&muxFila);
+    n = min<uint8_t>(filaTam, PIPELINE_MAX);
+    for (uint8_t i = 0; i < n; i++) voo[i] = loteNaFila(i);
+    filaEmVoo = n;
+    portEXIT_CRITICAL(&muxFila);
+    if (n == 0 || WiFi.status() != WL_CONNECTED) {
+      portENTER_CRITICAL(&muxFila);
+      filaEmVoo = 0;
+      portEXIT_CRITICAL(&muxFila);
+      // Fila vazia: dorme até o próximo lote; WiFi fora: confere de novo em 1 s
+      ulTaskNotifyTake(pdTRUE, n == 0 ? portMAX_DELAY : pdMS_TO_TICKS(1000));
+      continue;
+    }
+
+    iniciarRajadaRede();   // Boost e contagem de REDE só durante a rodada
+    uint32_t heapInicio = ESP.getFreeHeap();
+    bool confirmado[PIPELINE_MAX] = {};
+    uint8_t confirmados = 0;
+    int lento = -1;              // Lote cuja resposta estourou o prazo
+    int ultimoCode = -2;
+    uint32_t retryAfterS = 0;
+    if (httpConectar(conexao)) {
+      // Escreve todos os pedidos de uma vez; as respostas chegam na mesma ordem
+      unsigned long prazo = millis() + HTTP_RESPOSTA_MS;
+      uint8_t escritos = 0;
+      for (; escritos < n; escritos++) {
+        size_t len = montarPayload(payload, sizeof(payload), voo[escritos], millis());
+        size_t tam = httpCabecalho(cabecalho, sizeof(cabecalho), "/api/umidade/registrar",
+                                   "application/json", payload, len, nullptr);
+        if (!httpEscrever(conexao, cabecalho, tam, prazo) ||
+            !httpEscrever(conexao, payload, len, prazo)) break;
+      }
+      for (uint8_t i = 0; i < escritos; i++) {
+        RespostaHttp r = httpLerResposta(conexao, millis() + HTTP_RESPOSTA_MS, resposta, sizeof(resposta));
+        ultimoCode = r.code;
+        if (r.code <= 0) {
+          if (r.code == -1 && !cancelarHttp) lento = i;
+          break;
+        }
+        retryAfterS = max(retryAfterS, r.retryAfterS);
+        confirmado[i] = r.code == 200 || r.code == 201;
+        if (confirmado[i]) {
+          confirmados++;
+          aplicarConfig(resposta);
+        }
+        if (r.fechar) break;   // Os pedidos seguintes não serão respondidos
+      }
+      httpFechar(conexao);
+    }
+    medirHeap(MEM_ENVIO, heapInicio);
+    terminarRajadaRede();
+
+    portENTER_CRITICAL(&muxFila);
+    // Fusões só mexem depois de filaEmVoo: as posições 0..n-1 são as enviadas
+    for (int i = n - 1; i >= 0; i--) {
+      if (confirmado[i]) removerDaFila(i);
+    }
+    if (lento >= 0 && filaTam > 1) {
+      uint8_t pos = lento;
+      for (int i = 0; i < lento; i++) {
+        if (confirmado[i]) pos--;
+      }
+      LoteEnvio atrasado = loteNaFila(pos);
+      removerDaFila(pos);
+      loteNaFila(filaTam++) = atrasado;
+    }
+    filaEmVoo = 0;
+    uint8_t pendentes = filaTam;
+    portEXIT_CRITICAL(&muxFila);
+
+    // Backoff só quando a rodada inteira falhou; confirmou algo e sobrou fila: segue
+    unsigned long agora = millis();
+    unsigned long pausa = 0;
+    if (confirmados > 0) {
+      falhasSeguidas = 0;
+    } else {
+      if (falhasSeguidas < 16) falhasSeguidas++;
+      uint64_t backoff = (uint64_t)API_SEND_INTERVAL << (falhasSeguidas - 1);
+      pausa = (unsigned long)min<uint64_t>(backoff, BACKOFF_MAX_MS) + jitterDe(voo[0].seq + falhasSeguidas);
+    }
+    pausa = max(pausa, retryAfterS * 1000UL);
+    retomarEm = agora + pausa;
+
+    if (confirmados < n) {
+      Serial.printf("Uplink: %u/%u lotes confirmados (code %d), %u na fila, nova tentativa em %lu ms\n",
+                    confirmados, n, ultimoCode, pendentes, pausa);
+    }
+  }
+}
+
+void iniciarUplink() {
+  // Prioridade baixa no core 0, junto da captura; o loop fica no core 1
+  xTaskCreatePinnedToCore(tarefaUplink, "uplink", UPLINK_STACK, nullptr, 1, &tarefaUplinkHandle, 0);
+}
 
-// Keypad 4x4
-const byte ROWS = 4;
-const byte COLS = 4;
-char keys[ROWS][COLS] = {
-  {'1','2','3','A'},
-  {'4','5','6','B'},
-  {'7','8','9','C'},
-  {'*','0','#','D'}
-};
+void relatorioUplink() {
+  if constexpr (!TEM_WIFI) return;
+  Serial.printf("UPLINK: fila=%u/%u fundidos=%lu falhas seguidas=%u\n",
+                filaTam, FILA_ENVIO_LEN, (unsigned long)lotesFundidos, falhasSeguidas);
+}
 
-byte rowPins[ROWS] = {25, 16, 0, 2};
-byte colPins[COLS] = {15, 13, 12, 14};
-Keypad keypad = Keypad(makeKeymap(keys), rowPins, colPins, ROWS, COLS);
+// ==================== DASHBOARD LOCAL (SERVIDOR WEB) ====================
+// Página compacta pré-comprimida no LittleFS (/index.html.gz, gerada por
+// scripts/gzip_painel.py), JSON de estado/histórico e WebSocket com os valores
+// ao vivo. O servidor é assíncrono (tarefa do AsyncTCP): atender clientes
+// nunca bloqueia o loop de sensor e controle.
 
-// ==================== VARIÁVEIS DE ESTADO ====================
+#define HISTORICO_LEN       360     // 6 h com um ponto por minuto
+#define HISTORICO_INTERVAL  60000
 
-// Calibração do sensor (Valores de exemplo, recalibre se necessário)
-int ADC_DRY = 3000;
-int ADC_WET = 1200;
+// Histórico local: média do minuto em centésimos de %, com o uptime em s
+struct PontoHistorico {
+  uint32_t segundos;
+  uint16_t umidadeCentesimos;
+};
 
-// Estado do sistema
-float setpoint = 50.0;
-float umidade = 0.0;
-bool bombaLigada = false;
+PontoHistorico historico[HISTORICO_LEN];
+uint16_t historicoIdx = 0;
+uint16_t historicoQtd = 0;
+portMUX_TYPE muxHistorico = portMUX_INITIALIZER_UNLOCKED;  // Loop escreve, AsyncTCP lê
+unsigned long lastHistorico = 0;
+float somaMinuto = 0;
+unsigned long amostrasMinuto = 0;
 
-// Controle não-bloqueante
-unsigned long lastSensorRead = 0;
-unsigned long lastApiSend = 0;
-const unsigned long SENSOR_INTERVAL = 2000;    // Lê sensor a cada 2s
+// Tamanho e tempo de CPU de cada rota (só o handler; o envio é assíncrono)
+enum RotaWeb { ROTA_PAGINA, ROTA_ESTADO, ROTA_HISTORICO, ROTA_WS, ROTA_N };
+struct MetricaRota {
+  const char* nome;
+  uint32_t requisicoes = 0;
+  uint32_t bytes = 0;
+  uint32_t somaUs = 0;
+  uint32_t maxUs = 0;
+};
+MetricaRota metricasWeb[ROTA_N] = {
+  {"/"}, {"/api/estado"}, {"/api/historico"}, {"/ws"}
+};
 
-// Menu e telas
-enum Tela { TELA_PRINCIPAL, TELA_MENU_CONFIG, TELA_SETPOINT, TELA_CALIB_DRY, TELA_CALIB_WET, TELA_API_INTERVAL_CONFIG };
-Tela telaAtual = TELA_PRINCIPAL;
-String inputBuffer = "";
+#if COM_SERVIDOR_WEB
+// Construídos em iniciarPainelLocal(): perfis sem painel não criam nenhum
+AsyncWebServer* servidorWeb = nullptr;
+AsyncWebSocket* wsPainel = nullptr;
+#endif
+size_t tamanhoPagina = 0;
 
-// Filtro de leitura (média móvel)
-#define BUFFER_LEN 8
-float readings[BUFFER_LEN];
-int idx = 0;
-bool bufferFilled = false;
+void registrarMetricaWeb(RotaWeb rota, size_t bytes, unsigned long inicioUs) {
+  uint32_t us = micros() - inicioUs;
+  MetricaRota& m = metricasWeb[rota];
+  m.requisicoes++;
+  m.bytes += bytes;
+  m.somaUs += us;
+  m.maxUs = max(m.maxUs, us);
+}
 
-// ==================== PROTÓTIPOS ====================
-void atualizarTela();
+// Acumula a leitura no minuto corrente e fecha um ponto a cada HISTORICO_INTERVAL
+void registrarHistorico(float valor, unsigned long now) {
+  somaMinuto += valor;
+  amostrasMinuto++;
+  if (now - lastHistorico < HISTORICO_INTERVAL) return;
+  lastHistorico = now;
 
-// ==================== FUNÇÕES DO SENSOR ====================
+  PontoHistorico p = { (uint32_t)(now / 1000), (uint16_t)(somaMinuto / amostrasMinuto * 100) };
+  somaMinuto = 0;
+  amostrasMinuto = 0;
 
-// Conversão ADC para porcentagem
-float adcToPct(int adc) {
-  float pct = 100.0 * (ADC_DRY - adc) / float(ADC_DRY - ADC_WET);
-  return constrain(pct, 0.0, 100.0);
+  portENTER_CRITICAL(&muxHistorico);
+  historico[historicoIdx] = p;
+  historicoIdx = (historicoIdx + 1) % HISTORICO_LEN;
+  if (historicoQtd < HISTORICO_LEN) historicoQtd++;
+  portEXIT_CRITICAL(&muxHistorico);
 }
 
-// Leitura do sensor com filtro
-float readSoilPct() {
-  int raw = analogRead(SOIL_PIN);
-  float pct = adcToPct(raw);
-  
-  readings[idx++] = pct;
-  if (idx >= BUFFER_LEN) { 
-    idx = 0; 
-    bufferFilled = true; 
+size_t montarEstadoJson(char* buf, size_t len) {
+  int n = snprintf(buf, len,
+    "{\"umidade\":%.1f,\"setpoint\":%.0f,\"bomba\":%s,\"display\":%s,\"uptime\":%lu",
+    umidade, setpoint, bombaLigada ? "true" : "false", displayPresente ? "true" : "false",
+    millis() / 1000);
+  if (ambienteValido) {
+    n += snprintf(buf + n, len - n, ",\"temp_ar\":%.1f,\"umid_ar\":%.1f", temperaturaAr, umidadeAr);
   }
-  
-  float sum = 0;
-  int count = bufferFilled ? BUFFER_LEN : max(1, idx);
-  for (int i = 0; i < count; i++) sum += readings[i];
-  
-  return sum / count;
+  n += snprintf(buf + n, len - n, "}");
+  return n;
 }
 
-// ==================== FUNÇÕES DA BOMBA ====================
+// Envia o estado atual para todos os clientes WebSocket (chamado a cada leitura)
+void publicarEstadoWeb() {
+#if COM_SERVIDOR_WEB
+  if (!TEM_PAINEL_LOCAL || !wsPainel) return;
+  wsPainel->cleanupClients();
+  if (wsPainel->count() == 0) return;
 
-void ligarBomba() {
-  if (!bombaLigada) {
-    digitalWrite(LED_PIN, HIGH);
-    bombaLigada = true;
-    Serial.println("BOMBA LIGADA");
-  }
+  unsigned long inicio = micros();
+  char buf[160];
+  size_t n = montarEstadoJson(buf, sizeof(buf));
+  wsPainel->textAll(buf, n);
+  registrarMetricaWeb(ROTA_WS, n * wsPainel->count(), inicio);
+#endif
 }
 
-void desligarBomba() {
-  if (bombaLigada) {
-    digitalWrite(LED_PIN, LOW);
-    bombaLigada = false;
-    Serial.println("BOMBA DESLIGADA");
-  }
-}
+void iniciarPainelLocal() {
+  if constexpr (!TEM_PAINEL_LOCAL) return;
+#if COM_SERVIDOR_WEB
+  static AsyncWebServer servidor(80);
+  static AsyncWebSocket ws("/ws");
+  servidorWeb = &servidor;
+  wsPainel = &ws;
 
-// ==================== FUNÇÕES DE COMUNICAÇÃO (FastAPI) ====================
+  if (!LittleFS.begin()) {
+    Serial.println("LittleFS indisponivel: dashboard local sem pagina");
+  } else {
+    File f = LittleFS.open("/index.html.gz", "r");
+    if (f) {
+      tamanhoPagina = f.size();
+      f.close();
+    }
+  }
 
-bool sendSoilData(float umidadePct) {
-    if (WiFi.status() != WL_CONNECTED) {
-        Serial.println("WiFi desconectado, não é possível enviar dados.");
-        return false;
+  servidorWeb->on("/", HTTP_GET, [](AsyncWebServerRequest* req) {
+    unsigned long inicio = micros();
+    if (tamanhoPagina == 0) {
+      req->send(404, "text/plain", "Dashboard nao gravado (pio run -t uploadfs)");
+      return;
     }
+    AsyncWebServerResponse* resp = req->beginResponse(LittleFS, "/index.html.gz", "text/html");
+    resp->addHeader("Content-Encoding", "gzip");
+    resp->addHeader("Cache-Control", "max-age=86400");
+    req->send(resp);
+    registrarMetricaWeb(ROTA_PAGINA, tamanhoPagina, inicio);
+  });
 
-    HTTPClient http;
-    
-    // 1. Constrói a URL usando o FASTAPI_HOST
-    String url = "http://" + String(FASTAPI_HOST) + ":" + String(FASTAPI_PORT) + "/api/umidade/registrar"; 
-    
-    // 2. Payload JSON
-    String jsonPayload = "{\"umidade\": " + String(umidadePct, 2) + "}";
+  servidorWeb->on("/api/estado", HTTP_GET, [](AsyncWebServerRequest* req) {
+    unsigned long inicio = micros();
+    uint32_t heapInicio = ESP.getFreeHeap();
+    char buf[160];
+    size_t n = montarEstadoJson(buf, sizeof(buf));
+    req->send(200, "application/json", buf);
+    medirHeap(MEM_WEB, heapInicio);
+    registrarMetricaWeb(ROTA_ESTADO, n, inicio);
+  });
 
-    // 3. Inicia a requisição
-    http.begin(url);
-    
-    // 4. Configuração dos Headers
-    http.setReuse(false);
-    http.addHeader("Content-Type", "application/json");
-    
-    // Adiciona o header de autenticação
-    http.addHeader("X-API-Key", String(API_SECRET_KEY)); 
+  // Histórico em ordem cronológica: {"agora":s,"t":[...],"u":[...]}
+  servidorWeb->on("/api/historico", HTTP_GET, [](AsyncWebServerRequest* req) {
+    unsigned long inicio = micros();
+    uint32_t heapInicio = ESP.getFreeHeap();
+    AsyncResponseStream* resp = req->beginResponseStream("application/json");
+    size_t bytes = resp->printf("{\"agora\":%lu,\"t\":[", millis() / 1000);
 
-    int code = http.POST(jsonPayload);
-    
-    if (code > 0) {
-        if (code == 200 || code == 201) {
-            Serial.printf("Dados enviados com sucesso! Code: %d\n", code);
-            http.end();
-            return true;
-        } else {
-            Serial.printf("Erro ao enviar dados para a API. Code: %d\n", code);
-            Serial.println("Resposta do Servidor:");
-            Serial.println(http.getString()); 
-            http.end();
-            return false;
-        }
-    } else {
-        // Alerta o usuário para verificar o servidor/IP.
-        Serial.printf("ERRO FATAL HTTP CLIENT: Código: %d. Falha na conexão ou envio. (Verifique FASTAPI_HOST/Porta/Firewall)\n", code);
-        http.end();
-        return false;
-    }
+    // Estático (~2,9 KB fora da pilha do async_tcp); só esta tarefa roda handlers
+    static PontoHistorico copia[HISTORICO_LEN];
+    portENTER_CRITICAL(&muxHistorico);
+    uint16_t qtd = historicoQtd;
+    uint16_t primeiro = (historicoIdx + HISTORICO_LEN - qtd) % HISTORICO_LEN;
+    for (uint16_t i = 0; i < qtd; i++) copia[i] = historico[(primeiro + i) % HISTORICO_LEN];
+    portEXIT_CRITICAL(&muxHistorico);
+
+    for (uint16_t i = 0; i < qtd; i++) bytes += resp->printf(i ? ",%lu" : "%lu", (unsigned long)copia[i].segundos);
+    bytes += resp->print("],\"u\":[");
+    for (uint16_t i = 0; i < qtd; i++) bytes += resp->printf(i ? ",%.2f" : "%.2f", copia[i].umidadeCentesimos / 100.0);
+    bytes += resp->print("]}");
+    medirHeap(MEM_WEB, heapInicio);
+    req->send(resp);
+    registrarMetricaWeb(ROTA_HISTORICO, bytes, inicio);
+  });
+
+  servidorWeb->addHandler(wsPainel);
+  servidorWeb->begin();
+  Serial.println("Dashboard local em http://" + WiFi.localIP().toString() + "/");
+#endif
+}
+
+// Métricas do servidor: requisições, bytes médios e tempo de CPU por rota
+void relatorioPainelLocal() {
+  if constexpr (!TEM_PAINEL_LOCAL) return;
+  for (int i = 0; i < ROTA_N; i++) {
+    const MetricaRota& m = metricasWeb[i];
+    if (m.requisicoes == 0) continue;
+    Serial.printf("WEB %s: %u req | %u bytes/req | cpu medio=%u us max=%u us\n",
+                  m.nome, m.requisicoes, m.bytes / m.requisicoes, m.somaUs / m.requisicoes, m.maxUs);
+  }
 }
 
 // ==================== INTERFACE OLED ====================
+// As telas são dados (tabela TELAS, tipos em logica.h): título, linhas fixas,
+// parte dinâmica, campo numérico e mapa de teclas. Um único renderizador e um
+// único motor de teclado atendem todas; tela nova = uma entrada na tabela.
 
-void drawTelaPrincipal() {
-  display.clearDisplay();
-  display.setTextSize(1);
-  display.setTextColor(SSD1306_WHITE);
-  
+#define ENTRADA_MAX 4
+
+// Entrada numérica: buffer fixo (sem String)
+char entrada[ENTRADA_MAX + 1] = "";
+uint8_t entradaLen = 0;
+
+// --- Partes dinâmicas das telas ---
+
+void desenharPrincipal() {
   // Título
   display.setCursor(0, 2);
   display.print("IRRIGACAO ESP32");
   
   // WiFi indicator
-  if (WiFi.status() == WL_CONNECTED) {
+  if (TEM_WIFI && WiFi.status() == WL_CONNECTED) {
     display.setCursor(115, 2);
     display.print("W");
   }
@@ -202,8 +1804,8 @@ void drawTelaPrincipal() {
   int barX = 0, barY = 16, barW = 98, barH = 12;
   int fill = map(umidade, 0, 100, 0, barW);
   
-  display.drawRect(barX, barY, barW, barH, SSD1306_WHITE);
-  display.fillRect(barX + 1, barY + 1, max(0, fill - 2), barH - 2, SSD1306_WHITE);
+  display.drawRect(barX, barY, barW, barH, OLED_BRANCO);
+  display.fillRect(barX + 1, barY + 1, max(0, fill - 2), barH - 2, OLED_BRANCO);
   
   // Valor da umidade
   display.setCursor(barW + 9, barY + 3);
@@ -219,291 +1821,400 @@ void drawTelaPrincipal() {
   // Status da bomba
   display.setCursor(0, 43);
   display.print(bombaLigada ? "Bomba: LIGADA" : "Bomba: DESLIG");
-  
-  // Ajuda
-  display.setCursor(0, 55);
-  display.print("*=Menu Config");
-  
-  display.display();
+
+  // Previsão da próxima rega
+  long eta = estimadorSecagem.etaMin(setpoint);
+  if (!bombaLigada && eta >= 0) {
+    display.setCursor(84, 43);
+    display.printf("~%ldm", min(eta, 9999L));
+  }
 }
 
-void drawTelaMenuConfig() {
-  display.clearDisplay();
-  display.setTextSize(1);
-  display.setTextColor(SSD1306_WHITE);
-  
-  display.setCursor(0, 2);
-  display.print("MENU CONFIGURACAO");
-  
-  display.setCursor(0, 18);
-  display.print("A: Calibrar Sensor");
-  
-  display.setCursor(0, 29);
-  display.print("B: Configurar Alvo");
-  
-  display.setCursor(0, 40);
-  display.print("C: API Update(");
-  display.print(API_SEND_INTERVAL / 1000);
-  display.print(" seg)");
-  
-  display.setCursor(0, 51);
-  display.print("*: Voltar Principal");
-  
-  display.display();
+void desenharMenuIntervalo() {
+  display.setCursor(0, Y_LINHAS[2]);
+  display.printf("C: API Update(%lu seg)", API_SEND_INTERVAL / 1000);
 }
 
-void drawTelaSetpoint() {
-  display.clearDisplay();
-  display.setTextSize(1);
-  display.setTextColor(SSD1306_WHITE);
-  
-  display.setCursor(4, 2);
-  display.print("CONFIGURAR ALVO");
-  
-  display.setCursor(4, 18);
-  display.print("Alvo Atual: ");
-  display.print(setpoint, 0);
-  display.print("%");
-  
-  display.setCursor(0, 34);
-  display.print("Digite 0-100: ");
-  display.print(inputBuffer);
-  display.print("_");
-    
-  
-  display.setCursor(4, 57);
-  display.print("#=OK *=Voltar");
-  
-  display.display();
+void desenharSetpointAtual() {
+  display.setCursor(4, Y_LINHAS[0]);
+  display.printf("Alvo Atual: %.0f%%", setpoint);
 }
 
-void drawTelaApiIntervalConfig() {
-  display.clearDisplay();
-  display.setTextSize(1);
-  display.setTextColor(SSD1306_WHITE);
-  
-  display.setCursor(4, 2);
-  display.print("CONFIG. INTERVALO");
-  
-  display.setCursor(4, 18);
-  display.print("Atual: ");
-  display.print(API_SEND_INTERVAL / 1000);
-  display.print(" seg");
-  
-  display.setCursor(4, 34);
-  display.print("Novo (seg): ");
-  display.print(inputBuffer);
-  display.print("_");
-    
-  
-  display.setCursor(4, 57);
-  display.print("#=OK *=Voltar");
-  
-  display.display();
+void desenharIntervaloAtual() {
+  display.setCursor(4, Y_LINHAS[0]);
+  display.printf("Atual: %lu seg", API_SEND_INTERVAL / 1000);
 }
 
-void drawTelaCalibDry() {
-  display.clearDisplay();
-  display.setTextSize(1);
-  display.setTextColor(SSD1306_WHITE);
-  
-  display.setCursor(4, 2);
-  display.print("CALIBRACAO");
-  
-  display.setCursor(4, 18);
-  display.print("Sensor no AR SECO");
-  
-  display.setCursor(4, 34);
-  display.print("Pressione #");
-  
-  display.setCursor(4, 50);
-  int rawAdc = analogRead(SOIL_PIN);
-  display.print("ADC: ");
-  display.print(rawAdc);
-  
-  display.display();
+void desenharAdc() {
+  display.setCursor(4, Y_LINHAS[2]);
+  display.printf("ADC: %d", lerAdcCalibracao());
 }
 
-void drawTelaCalibWet() {
-  display.clearDisplay();
-  display.setTextSize(1);
-  display.setTextColor(SSD1306_WHITE);
-  
-  display.setCursor(4, 2);
-  display.print("CALIBRACAO");
-  
-  display.setCursor(4, 18);
-  display.print("Sensor na AGUA");
-  
-  display.setCursor(4, 34);
-  display.print("Pressione #");
-  
-  display.setCursor(4, 50);
-  int rawAdc = analogRead(SOIL_PIN);
-  display.print("ADC: ");
-  display.print(rawAdc);
-  
-  display.display();
+// --- Ações ---
+
+void aplicarSetpoint(long valor) {
+  setpoint = valor;
+  Serial.printf("Setpoint alterado: %.0f%%\n", setpoint);
+}
+
+void aplicarIntervaloApi(long segundos) {
+  API_SEND_INTERVAL = segundos * 1000; // Converte Segundos para Milissegundos
+  proximoEnvio = millis() + API_SEND_INTERVAL;
+  Serial.printf("Intervalo API alterado: %ld segundos (%lu ms)\n", segundos, API_SEND_INTERVAL);
+}
+
+void calibrarSeco() {
+  ADC_DRY = lerAdcCalibracao();
+  Serial.printf("Calibrado SECO: %d\n", ADC_DRY);
+}
+
+void calibrarMolhado() {
+  ADC_WET = lerAdcCalibracao();
+  Serial.printf("Calibrado MOLHADO: %d\n", ADC_WET);
+}
+
+void confirmarCampo();
+
+// --- Tabela de telas (na ordem do enum Tela) ---
+
+constexpr CampoNumerico CAMPO_SETPOINT = { "Digite 0-100: ", 3, 0, 100, aplicarSetpoint };
+// Máximo 4 dígitos (até 9999 segundos), mínimo 1 segundo
+constexpr CampoNumerico CAMPO_INTERVALO = { "Novo (seg): ", 4, 1, 9999, aplicarIntervaloApi };
+
+constexpr AcaoTecla TECLAS_PRINCIPAL[] = { {'*', TELA_MENU_CONFIG, nullptr} };
+constexpr AcaoTecla TECLAS_MENU[] = {
+  {'A', TELA_CALIB_DRY, nullptr},
+  {'B', TELA_SETPOINT, nullptr},
+  {'C', TELA_API_INTERVAL_CONFIG, nullptr},
+  {'*', TELA_PRINCIPAL, nullptr},
+};
+constexpr AcaoTecla TECLAS_CAMPO[] = {
+  {'#', TELA_MENU_CONFIG, confirmarCampo},
+  {'*', TELA_MENU_CONFIG, nullptr},
+};
+constexpr AcaoTecla TECLAS_CALIB_DRY[] = {
+  {'#', TELA_CALIB_WET, calibrarSeco},
+  {'*', TELA_MENU_CONFIG, nullptr},
+};
+constexpr AcaoTecla TECLAS_CALIB_WET[] = {
+  {'#', TELA_MENU_CONFIG, calibrarMolhado},  // Volta para o Menu após calibração
+  {'*', TELA_MENU_CONFIG, nullptr},
+};
+
+#define TECLAS(t) t, sizeof(t) / sizeof(t[0])
+
+constexpr DefTela TELAS[TELA_N] = {
+  // TELA_PRINCIPAL
+  { nullptr, {}, "*=Menu Config", desenharPrincipal, nullptr, TECLAS(TECLAS_PRINCIPAL) },
+  // TELA_MENU_CONFIG
+  { "MENU CONFIGURACAO", {"A: Calibrar Sensor", "B: Configurar Alvo"}, "*: Voltar Principal",
+    desenharMenuIntervalo, nullptr, TECLAS(TECLAS_MENU) },
+  // TELA_SETPOINT
+  { "CONFIGURAR ALVO", {}, "#=OK *=Voltar", desenharSetpointAtual, &CAMPO_SETPOINT, TECLAS(TECLAS_CAMPO) },
+  // TELA_CALIB_DRY
+  { "CALIBRACAO", {"Sensor no AR SECO", "Pressione #"}, "#=OK *=Voltar", desenharAdc, nullptr, TECLAS(TECLAS_CALIB_DRY) },
+  // TELA_CALIB_WET
+  { "CALIBRACAO", {"Sensor na AGUA", "Pressione #"}, "#=OK *=Voltar", desenharAdc, nullptr, TECLAS(TECLAS_CALIB_WET) },
+  // TELA_API_INTERVAL_CONFIG
+  { "CONFIG. INTERVALO", {}, "#=OK *=Voltar", desenharIntervaloAtual, &CAMPO_INTERVALO, TECLAS(TECLAS_CAMPO) },
+};
+
+// Confirma o campo numérico da tela atual, se o valor estiver nos limites
+void confirmarCampo() {
+  const CampoNumerico* campo = TELAS[telaAtual].campo;
+  long valor = atol(entrada);
+  if (entradaLen > 0 && valor >= campo->minimo && valor <= campo->maximo) {
+    campo->aplicar(valor);
+  } else {
+    Serial.printf("ERRO: valor deve estar entre %ld e %ld.\n", campo->minimo, campo->maximo);
+  }
+}
+
+// Energia do painel: sem tecla por TELA_ESCURECER_MS o contraste cai; depois
+// de TELA_DORMIR_MS o controlador entra em sleep e atualizarTela() não compõe
+// nem envia mais nada. Qualquer tecla acorda: a tela atual é composta e
+// enviada com o painel ainda apagado, então ele já religa mostrando o quadro
+// certo. A tecla que acorda o painel dormindo não é processada.
+#define TELA_ESCURECER_MS     60000
+#define TELA_DORMIR_MS        300000
+#define TELA_CONTRASTE        0xCF
+#define TELA_CONTRASTE_BAIXO  0x01
+
+void gerenciarEnergiaTela(unsigned long now) {
+  if (!TEM_DISPLAY || !displayPresente || estadoPainel == PAINEL_DORMINDO) return;
+  unsigned long inativo = now - ultimaAtividadeTela;
+  if (inativo >= TELA_DORMIR_MS) {
+    display.dormir();
+    estadoPainel = PAINEL_DORMINDO;
+  } else if (inativo >= TELA_ESCURECER_MS && estadoPainel == PAINEL_ACESO) {
+    display.contraste(TELA_CONTRASTE_BAIXO);
+    estadoPainel = PAINEL_ESCURO;
+  }
+}
+
+// Registra atividade e devolve o painel ao normal; false se ele estava dormindo
+bool acordarTela(unsigned long now) {
+  ultimaAtividadeTela = now;
+  if (!TEM_DISPLAY || !displayPresente || estadoPainel == PAINEL_ACESO) return true;
+  bool dormia = estadoPainel == PAINEL_DORMINDO;
+  estadoPainel = PAINEL_ACESO;
+  display.contraste(TELA_CONTRASTE);
+  if (dormia) {
+    atualizarTela();
+    display.acordar();
+  }
+  return !dormia;
+}
+
+// Detecta o painel no barramento (ACK no endereço) e o inicializa.
+// Sem painel o sistema segue headless: sensor, controle e envio continuam.
+bool iniciarDisplay() {
+  Wire.beginTransmission(OLED_ADDR);
+  if (Wire.endTransmission() != 0) {
+    return false;
+  }
+  uint32_t heapInicio = ESP.getFreeHeap();
+  if (!display.begin(OLED_ADDR)) {
+    Serial.println(F("Falha ao iniciar display OLED"));
+    return false;
+  }
+  medirHeap(MEM_DISPLAY, heapInicio);
+  estadoPainel = PAINEL_ACESO;   // begin() religa o painel com o contraste normal
+  ultimaAtividadeTela = millis();
+  return true;
+}
+
+// Renderizador único (logica.h): monta a tela atual no framebuffer (sem I2C)
+void comporTela() {
+  comporTela(display, TELAS[telaAtual], entrada);
 }
 
 void atualizarTela() {
-  switch (telaAtual) {
-    case TELA_PRINCIPAL:             drawTelaPrincipal(); break;
-    case TELA_MENU_CONFIG:           drawTelaMenuConfig(); break; 
-    case TELA_SETPOINT:              drawTelaSetpoint(); break;
-    case TELA_CALIB_DRY:             drawTelaCalibDry(); break;
-    case TELA_CALIB_WET:             drawTelaCalibWet(); break;
-    case TELA_API_INTERVAL_CONFIG:   drawTelaApiIntervalConfig(); break; 
+  if constexpr (!TEM_DISPLAY) return; // Perfil sem display: nada a desenhar
+  if (!displayPresente) return;       // Painel ausente: economiza o tempo de I2C
+  if (estadoPainel == PAINEL_DORMINDO) return;   // Ninguém olhando: nada a compor
+  i2cUsadoNesteLoop = true;
+
+  unsigned long inicio = micros();
+  comporTela();
+  bool enviado = display.display();
+  telaSomaUs += micros() - inicio;
+  telaQuadros++;
+
+  // Painel removido/travado depois do boot: para de mandar I2C e deixa o
+  // reprobe do loop detectá-lo de novo
+  falhasDisplay = enviado ? 0 : falhasDisplay + 1;
+  if (falhasDisplay >= DISPLAY_FALHAS_MAX) {
+    falhasDisplay = 0;
+    displayPresente = false;
+    lastDisplayProbe = millis();
+    Serial.println("Display parou de responder: operando sem tela (headless)");
   }
 }
 
 // ==================== KEYPAD ====================
 
+// Motor único (logica.h) sobre a tabela de telas e o campo de entrada globais
+void processarTecla(char k) {
+  processarTecla(TELAS, telaAtual, entrada, entradaLen, k);
+}
+
 void handleKeypad() {
   char k = keypad.getKey();
   if (!k) return;
+  if (!acordarTela(millis())) return;   // Só acordou o painel
+  unsigned long inicio = micros();
   
   Serial.printf("Tecla: %c | Tela: %d\n", k, telaAtual);
   
-  switch (telaAtual) {
-    
-    case TELA_PRINCIPAL:
-      if (k == '*') {
-        telaAtual = TELA_MENU_CONFIG;
-      }
-      break;
+  processarTecla(k);
+  atualizarTela();
+
+  unsigned long us = micros() - inicio;
+  teclaSomaUs += us;
+  teclaMaxUs = max(teclaMaxUs, us);
+  teclaAmostras++;
+}
+
+// ==================== LÓGICA DE IRRIGAÇÃO (SIMPLIFICADA) ====================
+
+// Preditivo: quando o estimador prevê que o alvo será cruzado em menos da
+// antecipação, rega um pulso curto e espera o estimador reaprender o nível (a
+// água assenta) antes de decidir outro. Abaixo do alvo continua o controle
+// reativo, com a bomba ligada direto até o alvo mais a zona morta. Antecipação,
+// pulso e zona morta vêm do ajuste do backend (padrões acima sem ele).
+
+enum FaseRega : uint8_t { REGA_PARADA, REGA_PULSO, REGA_CONTINUA };
+FaseRega faseRega = REGA_PARADA;
+unsigned long fimPulso = 0;
 
-    case TELA_MENU_CONFIG:
-      if (k == 'A') {
-        telaAtual = TELA_CALIB_DRY;
-      } else if (k == 'B') {
-        telaAtual = TELA_SETPOINT;
-        inputBuffer = "";
-      } else if (k == 'C') {
-        telaAtual = TELA_API_INTERVAL_CONFIG;
-        inputBuffer = "";
-      } else if (k == '*') {
-        telaAtual = TELA_PRINCIPAL;
+void controlIrrigation() {
+  unsigned long now = millis();
+  ParametrosControle p = lerParametros();
+
+  // LIGA a bomba se a umidade estiver ABAIXO do setpoint
+  if (umidade < setpoint) {
+    faseRega = REGA_CONTINUA;
+    ligarBomba();
+    return;
+  }
+
+  switch (faseRega) {
+    case REGA_CONTINUA:
+      // DESLIGA a bomba quando a umidade passa do setpoint pela zona morta
+      if (umidade >= setpoint + p.zonaMorta) {
+        desligarBomba();
+        faseRega = REGA_PARADA;
       }
       break;
-      
-    case TELA_SETPOINT:
-      if (k == '#') {
-        float val = inputBuffer.toFloat();
-        if (val >= 0 && val <= 100) {
-          setpoint = val;
-          Serial.printf("Setpoint alterado: %.0f%%\n", setpoint);
-        }
-        inputBuffer = "";
-        telaAtual = TELA_MENU_CONFIG; // Volta para o Menu
-      }
-      else if (k == '*') {
-        inputBuffer = "";
-        telaAtual = TELA_MENU_CONFIG;
-      }
-      else if (k >= '0' && k <= '9') {
-        if (inputBuffer.length() < 3) {
-          inputBuffer += k;
-        }
+    case REGA_PULSO:
+      if ((long)(now - fimPulso) >= 0) {
+        desligarBomba();   // Reinicia o nível do estimador: sem ETA até assentar
+        faseRega = REGA_PARADA;
       }
       break;
-      
-    // ALTERADO: CONFIGURAÇÃO DO INTERVALO API EM SEGUNDOS
-    case TELA_API_INTERVAL_CONFIG:
-      if (k == '#') {
-        // Confirma o valor (em segundos)
-        unsigned long val_sec = inputBuffer.toInt();
-        if (val_sec >= 1) { // Garante que o intervalo mínimo é 1 segundo
-          API_SEND_INTERVAL = val_sec * 1000; // Converte Segundos para Milissegundos
-          Serial.printf("Intervalo API alterado: %lu segundos (%lu ms)\n", val_sec, API_SEND_INTERVAL);
-        } else {
-             Serial.println("ERRO: Intervalo API deve ser no mínimo 1 segundo.");
-        }
-        inputBuffer = "";
-        telaAtual = TELA_MENU_CONFIG; // Volta para o Menu
-      }
-      else if (k == '*') {
-        inputBuffer = "";
-        telaAtual = TELA_MENU_CONFIG;
-      }
-      else if (k >= '0' && k <= '9') {
-        // Máximo 4 dígitos (até 9999 segundos)
-        if (inputBuffer.length() < 4) {
-          inputBuffer += k;
-        }
+    case REGA_PARADA: {
+      long eta = estimadorSecagem.etaMin(setpoint);
+      if (eta >= 0 && eta < p.antecipacaoMin) {
+        Serial.printf("Rega preditiva: alvo em ~%ld min (%.2f %%/h)\n", eta, estimadorSecagem.taxa * 60);
+        ligarBomba();
+        fimPulso = now + p.pulsoMs;
+        faseRega = REGA_PULSO;
       }
       break;
+    }
+  }
+}
 
-    case TELA_CALIB_DRY:
-      if (k == '#') {
-        ADC_DRY = analogRead(SOIL_PIN);
-        Serial.printf("Calibrado SECO: %d\n", ADC_DRY);
-        telaAtual = TELA_CALIB_WET;
-      }
-      else if (k == '*') {
-         telaAtual = TELA_MENU_CONFIG;
-      }
-      break;
-      
-    case TELA_CALIB_WET:
-      if (k == '#') {
-        ADC_WET = analogRead(SOIL_PIN);
-        Serial.printf("Calibrado MOLHADO: %d\n", ADC_WET);
-        telaAtual = TELA_MENU_CONFIG; // Volta para o Menu após calibração
-      }
-      else if (k == '*') {
-         telaAtual = TELA_MENU_CONFIG;
-      }
-      break;
+// ==================== BANCADA (DESEMPENHO) ====================
+// Mede em ciclos de CPU (ESP.getCycleCount) os caminhos quentes da lógica pura
+// e imprime uma linha "BANCADA {json}" que scripts/bancada.py grava e compara
+// entre versões. Só existe no env esp32dev_bancada (-DBANCADA); roda no boot e
+// a cada 'b' recebido pela serial.
+#ifdef BANCADA
+
+#define BANCADA_ITER     1000
+#define BANCADA_RODADAS  5      // Vale a melhor rodada (menos ruído de interrupções)
+#define BANCADA_CASOS    (8 + TELA_N)
+
+volatile float bancadaSumidouro;   // Impede o compilador de descartar o trabalho medido
+
+struct CasoBancada {
+  char nome[16];
+  uint32_t iter;
+  uint32_t ciclosIter;
+};
+
+template <typename F>
+CasoBancada medirCaso(const char* nome, uint32_t iter, F&& corpo) {
+  CasoBancada c = {};
+  strncpy(c.nome, nome, sizeof(c.nome) - 1);
+  c.iter = iter;
+  c.ciclosIter = UINT32_MAX;
+  for (int r = 0; r < BANCADA_RODADAS; r++) {
+    uint32_t inicio = ESP.getCycleCount();
+    for (uint32_t i = 0; i < iter; i++) corpo(i);
+    c.ciclosIter = min(c.ciclosIter, (ESP.getCycleCount() - inicio) / iter);
   }
-  
-  atualizarTela();
+  return c;
 }
 
-// ==================== LÓGICA DE IRRIGAÇÃO (SIMPLIFICADA) ====================
+void rodarBancada() {
+  static CasoBancada casos[BANCADA_CASOS];
+  size_t n = 0;
+  entrarEstadoEnergia(ENERGIA_ATIVO);   // Mesmo clock do loop em operação
 
-void controlIrrigation() {
-  // Limites de umidade definem a ação
-  
-  // LIGA a bomba se a umidade estiver ABAIXO do setpoint
-  if (umidade < setpoint) {
-    ligarBomba();
+  casos[n++] = medirCaso("adcToPct", BANCADA_ITER, [](uint32_t i) {
+    bancadaSumidouro = adcToPct(1200 + (i & 2047));
+  });
+
+  FiltroLeitura<PERFIL.filtro, PERFIL.janelaFiltro> filtro;
+  casos[n++] = medirCaso("filtro", BANCADA_ITER, [&](uint32_t i) {
+    bancadaSumidouro = filtro.aplicar(i % 100);
+  });
+
+  // Inclui o analogRead; o estado do filtro real é restaurado depois
+  auto filtroSalvo = filtroSolo;
+  casos[n++] = medirCaso("readSoilPct", BANCADA_ITER / 10, [](uint32_t) {
+    bancadaSumidouro = readSoilPct();
+  });
+  filtroSolo = filtroSalvo;
+
+  EstimadorSecagem estimador = estimadorSecagem;
+  estimador.assentaAte = 0;
+  casos[n++] = medirCaso("secagem", BANCADA_ITER, [&](uint32_t i) {
+    estimador.adicionar(50 - i * 0.001f, estimador.ultimo + PERFIL.intervaloSensor);
+    bancadaSumidouro = estimador.taxa;
+  });
+
+  static char payload[PAYLOAD_MAX];
+  EstatisticaIntervalo est = estatIntervalo;
+  if (est.n == 0) est.adicionar(umidade);
+  uint32_t seqSalvo = seqEnvio;
+  unsigned long loopMaxSalvo = loopMaxEnvioUs;
+  LoteEnvio lote = capturarLote(est, millis());
+  seqEnvio = seqSalvo;
+  loopMaxEnvioUs = loopMaxSalvo;
+  casos[n++] = medirCaso("payload", BANCADA_ITER / 10, [&](uint32_t i) {
+    bancadaSumidouro = montarPayload(payload, sizeof(payload), lote, lote.criadoMs + i);
+  });
+
+  // Assinatura de um payload típico com contexto e chave de teste locais: a
+  // chave do nó e o seq global (em uso pelo uplink no outro núcleo) ficam intactos
+  static const uint8_t chaveTeste[HMAC_CHAVE_LEN] = {};
+  mbedtls_md_context_t ctxTeste;
+  mbedtls_md_init(&ctxTeste);
+  mbedtls_md_setup(&ctxTeste, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1);
+  mbedtls_md_hmac_starts(&ctxTeste, chaveTeste, HMAC_CHAVE_LEN);
+  size_t tamPayload = montarPayload(payload, sizeof(payload), lote, lote.criadoMs);
+  static char autenticacao[224];
+  casos[n++] = medirCaso("hmac", BANCADA_ITER / 10, [&](uint32_t i) {
+    bancadaSumidouro = montarAssinatura(autenticacao, sizeof(autenticacao), ctxTeste, i + 1,
+                                        EPOCH_VALIDA, payload, tamPayload);
+  });
+  mbedtls_md_free(&ctxTeste);
+
+  // Despacho de teclas: dígito no campo + saída da tela (sem desenhar)
+  Tela telaSalva = telaAtual;
+  casos[n++] = medirCaso("tecla", BANCADA_ITER, [](uint32_t) {
+    telaAtual = TELA_SETPOINT;
+    processarTecla('5');
+    processarTecla('*');
+  });
+  telaAtual = TELA_SETPOINT;
+  processarTecla('*');   // Limpa o campo de entrada usado acima
+
+  // Composição de cada tela no framebuffer (só com o painel inicializado)
+  if (TEM_DISPLAY && displayPresente) {
+    for (uint8_t t = 0; t < TELA_N; t++) {
+      char nome[16];
+      snprintf(nome, sizeof(nome), "tela_%u", t);
+      telaAtual = (Tela)t;
+      casos[n++] = medirCaso(nome, BANCADA_ITER / 10, [](uint32_t) { comporTela(); });
+    }
   }
-  // DESLIGA a bomba se a umidade estiver ACIMA ou IGUAL ao setpoint
-  else if (umidade >= setpoint) {
-    desligarBomba();
+  telaAtual = telaSalva;
+  atualizarTela();
+
+  uint32_t mhz = getCpuFrequencyMhz();
+  Serial.printf("BANCADA {\"perfil\":\"%s\",\"compilado\":\"%s %s\",\"mhz\":%u,\"casos\":[",
+                PERFIL.nome, __DATE__, __TIME__, mhz);
+  for (size_t i = 0; i < n; i++) {
+    Serial.printf("%s{\"nome\":\"%s\",\"iter\":%u,\"ciclos\":%u,\"ns\":%u}", i ? "," : "",
+                  casos[i].nome, casos[i].iter, casos[i].ciclosIter, casos[i].ciclosIter * 1000 / mhz);
   }
+  Serial.println("]}");
 }
 
+#endif
+
 // ==================== SETUP ====================
 
-void setup() {
-  Serial.begin(115200);
-  delay(500);
-  Serial.println("Sistema de Irrigacao ESP32");
-  
-  // LED (bomba)
-  pinMode(LED_PIN, OUTPUT);
-  digitalWrite(LED_PIN, LOW);
-  
-  // I2C para OLED
-  Wire.begin(OLED_SDA, OLED_SCL);
-  
-  // OLED
-  if(!display.begin(SSD1306_SWITCHCAPVCC, 0x3C)) {
-    Serial.println(F("Falha ao iniciar display SSD1306"));
-    for(;;);
-  }
-  display.clearDisplay();
-  display.setTextSize(1);
-  display.setTextColor(SSD1306_WHITE);
-  display.setCursor(0, 2);
-  display.print("Iniciando...");
-  display.display();
-  
-  // WiFi
+void conectarWiFi() {
+  // WiFi (conexão em clock máximo)
+  entrarEstadoEnergia(ENERGIA_REDE);
   Serial.print("Conectando WiFi");
-  WiFi.begin(ssid, password);
+  iniciarWiFiEconomico();
   
   int tentativas = 0;
   while (WiFi.status() != WL_CONNECTED && tentativas < 20) {
@@ -519,6 +2230,54 @@ void setup() {
   } else {
     Serial.println("\nWiFi nao conectado.");
   }
+}
+
+void setup() {
+  Serial.begin(115200);
+  delay(500);
+  Serial.println("Sistema de Irrigacao ESP32");
+  Serial.printf("Perfil: %s | sketch=%u bytes | heap livre=%u bytes\n",
+                PERFIL.nome, ESP.getSketchSize(), ESP.getFreeHeap());
+  
+  // LED (bomba)
+  pinMode(LED_PIN, OUTPUT);
+  iniciarSonda();
+  digitalWrite(LED_PIN, LOW);
+  
+  if constexpr (TEM_DISPLAY || TEM_AMBIENTE) {
+    // I2C compartilhado: OLED e sensor ambiente
+    Wire.begin(OLED_SDA, OLED_SCL);
+    Wire.setClock(OLED_I2C_HZ);
+    iniciarSensorAmbiente();
+  }
+  
+  if constexpr (TEM_DISPLAY) {
+    // OLED (opcional: sem painel o sistema opera headless)
+    displayPresente = iniciarDisplay();
+    if (displayPresente) {
+      display.clearDisplay();
+      display.setTextSize(1);
+      display.setTextColor(OLED_BRANCO);
+      display.setCursor(0, 2);
+      display.print("Iniciando...");
+      display.display();
+    } else {
+      Serial.println("Display ausente: operando sem tela (headless)");
+    }
+  }
+  
+  iniciarIdentidade();
+  Serial.printf("Dispositivo: %s\n", dispositivoId);
+  if constexpr (TEM_WIFI) {
+    conectarWiFi();
+    configTime(0, 0, "pool.ntp.org");   // Só para o X-Timestamp da assinatura (UTC)
+    iniciarAssinatura();
+    iniciarAgendador(millis());
+    iniciarUplink();
+  }
+  configurarEnergia();
+  iniciarCaptura();
+  iniciarPainelLocal();
   
   // Tela principal
   telaAtual = TELA_PRINCIPAL;
@@ -526,16 +2285,40 @@ void setup() {
   
   Serial.println("Sistema pronto!");
   Serial.println("Teclas: * = Menu Config");
+
+#ifdef BANCADA
+  rodarBancada();
+#endif
 }
 // ==================== LOOP ====================
 
 void loop() {
+  entrarEstadoEnergia(ENERGIA_ATIVO);
+  unsigned long inicioLoopUs = micros();
   unsigned long now = millis();
+  i2cUsadoNesteLoop = false;
   
-  // Leitura do sensor (a cada 2s)
-  if (now - lastSensorRead >= SENSOR_INTERVAL) {
+  // Sonda: liga antes da leitura para estabilizar; solta a da calibração
+  if (TEM_GATE_SONDA && now - lastSensorRead >= SENSOR_INTERVAL - PERFIL.estabilizacaoSonda) {
+    usarSonda(SONDA_LEITURA, true);
+  }
+  if (TEM_GATE_SONDA && telaAtual != TELA_CALIB_DRY && telaAtual != TELA_CALIB_WET) {
+    usarSonda(SONDA_CALIBRACAO, false);
+  }
+
+  // Leitura do sensor (a cada 2s), com a sonda já estável
+  if (now - lastSensorRead >= SENSOR_INTERVAL && sondaEstavel(now)) {
     umidade = readSoilPct();
+    usarSonda(SONDA_LEITURA, false);
+    estatIntervalo.adicionar(umidade);
+    if (!bombaLigada) {
+      estimadorSecagem.adicionar(umidade, now);
+    }
     lastSensorRead = now;
+    if constexpr (TEM_PAINEL_LOCAL) {
+      registrarHistorico(umidade, now);
+      publicarEstadoWeb();
+    }
     
     // Atualiza tela principal
     if (telaAtual == TELA_PRINCIPAL) {
@@ -543,20 +2326,62 @@ void loop() {
     }
   }
   
-  // Envio de Dados para o FastAPI (usa API_SEND_INTERVAL, que agora é dinâmico)
-  if (now - lastApiSend >= API_SEND_INTERVAL) {
-      if (WiFi.status() == WL_CONNECTED) {
-          sendSoilData(umidade); 
+  // Painel ausente: tenta detectar de novo de tempos em tempos (hot-plug)
+  if (TEM_DISPLAY && !displayPresente && now - lastDisplayProbe >= DISPLAY_REPROBE_INTERVAL) {
+    lastDisplayProbe = now;
+    if (iniciarDisplay()) {
+      displayPresente = true;
+      Serial.println("Display detectado");
+      atualizarTela();
+    }
+  }
+  
+  // Envio de Dados para o FastAPI: fecha o intervalo e entrega à tarefa de uplink
+  if (TEM_WIFI && (long)(now - proximoEnvio) >= 0) {
+      if (estatIntervalo.n > 0) {
+          enfileirarLote(capturarLote(estatIntervalo, now));
+          estatIntervalo.zerar();
       }
-      lastApiSend = now;
+      agendarProximoEnvio(now);
+  }
+  if constexpr (TEM_WIFI) {
+      cancelarHttp = WiFi.status() != WL_CONNECTED;   // Aborta esperas do uplink
   }
   
-  // Teclado (sempre verifica)
+  // Teclado (sempre verifica) e energia do painel
   handleKeypad();
+  gerenciarEnergiaTela(now);
+
+#ifdef BANCADA
+  if (Serial.available() && Serial.read() == 'b') {
+    rodarBancada();
+  }
+#endif
+  
+  // Sensor ambiente: só usa o I2C se o display não o usou nesta volta
+  passoSensorAmbiente(now);
   
   // Lógica de irrigação (sempre executa)
   controlIrrigation();
   
-  // Pequeno delay para não sobrecarregar
+  // Tempo de execução do loop (inclui envios, exclui o delay)
+  unsigned long duracaoLoopUs = micros() - inicioLoopUs;
+  loopSomaUs += duracaoLoopUs;
+  loopMaxUs = max(loopMaxUs, duracaoLoopUs);
+  loopMaxEnvioUs = max(loopMaxEnvioUs, duracaoLoopUs);
+  loopAmostras++;
+  
+  // Relatórios de energia e de desempenho do perfil
+  if (now - lastRelatorioEnergia >= RELATORIO_ENERGIA_INTERVAL) {
+    relatorioEnergia();
+    relatorioPerfil();
+    relatorioPainelLocal();
+    relatorioMemoria();
+    relatorioUplink();
+    lastRelatorioEnergia = now;
+  }
+  
+  // Pequeno delay para não sobrecarregar (CPU ociosa / light sleep)
+  entrarEstadoEnergia(ENERGIA_OCIOSO);
   delay(50);
 }
\ No newline at end of file
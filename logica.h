@@ -0,0 +1,240 @@
+/* Lógica pura do firmware: filtro e conversão da leitura, resumo do intervalo,
+   payload do uplink, motor de teclado dos menus e composição das telas.
+   Não depende de Arduino/FreeRTOS nem do estado global de esp32.cpp (tudo
+   entra por parâmetro), então compila também no host: a bancada em bancada/
+   (Google Benchmark) mede exatamente o mesmo código que vai para a placa.
+*/
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <math.h>
+
+// ==================== FILTRO DE LEITURA ====================
+
+enum class TipoFiltro : uint8_t { MEDIA_MOVEL, EXPONENCIAL };
+
+// Especializado em compilação pelo tipo do perfil
+template <TipoFiltro F, uint8_t N> struct FiltroLeitura;
+
+// Média móvel com soma corrente (O(1) por amostra)
+template <uint8_t N> struct FiltroLeitura<TipoFiltro::MEDIA_MOVEL, N> {
+  float readings[N] = {0};
+  float soma = 0;
+  uint8_t idx = 0;
+  bool bufferFilled = false;
+
+  float aplicar(float pct) {
+    soma += pct - readings[idx];
+    readings[idx++] = pct;
+    if (idx >= N) {
+      idx = 0;
+      bufferFilled = true;
+    }
+    int count = bufferFilled ? N : (idx > 0 ? idx : 1);
+    return soma / count;
+  }
+};
+
+// Média exponencial equivalente a N amostras (alpha = 2/(N+1)), sem buffer
+template <uint8_t N> struct FiltroLeitura<TipoFiltro::EXPONENCIAL, N> {
+  static constexpr float ALPHA = 2.0f / (N + 1);
+  float valor = 0;
+  bool iniciado = false;
+
+  float aplicar(float pct) {
+    valor = iniciado ? valor + ALPHA * (pct - valor) : pct;
+    iniciado = true;
+    return valor;
+  }
+};
+
+// ==================== CONVERSÃO ADC ====================
+
+// Calibração linear (seco = 0%, molhado = 100%), saturada nos extremos
+inline float adcToPct(int adc, int adcSeco, int adcMolhado) {
+  float pct = 100.0 * (adcSeco - adc) / float(adcSeco - adcMolhado);
+  return pct < 0.0f ? 0.0f : (pct > 100.0f ? 100.0f : pct);
+}
+
+// ==================== RESUMO DO INTERVALO ====================
+
+// Resumo das leituras filtradas de um intervalo (Welford: O(1) memória,
+// numericamente estável). Zerado ao fechar o intervalo e enfileirar o lote;
+// com a fila de envio cheia, os dois lotes mais velhos se fundem com juntar().
+struct EstatisticaIntervalo {
+  unsigned long n = 0;
+  float minimo = 0;
+  float maximo = 0;
+  float media = 0;
+  float m2 = 0;      // Soma dos quadrados dos desvios
+  float ultimo = 0;
+
+  void adicionar(float v) {
+    n++;
+    if (n == 1) {
+      minimo = maximo = v;
+    } else {
+      if (v < minimo) minimo = v;
+      if (v > maximo) maximo = v;
+    }
+    float delta = v - media;
+    media += delta / n;
+    m2 += delta * (v - media);
+    ultimo = v;
+  }
+
+  float desvio() const {
+    return n > 1 ? sqrtf(m2 / (n - 1)) : 0.0f;
+  }
+
+  // Junta outro intervalo (Chan et al.): usado ao fundir lotes na fila de envio
+  void juntar(const EstatisticaIntervalo& o) {
+    if (o.n == 0) return;
+    if (n == 0) {
+      *this = o;
+      return;
+    }
+    unsigned long total = n + o.n;
+    float delta = o.media - media;
+    m2 += o.m2 + delta * delta * ((float)n * o.n / total);
+    media += delta * o.n / total;
+    if (o.minimo < minimo) minimo = o.minimo;
+    if (o.maximo > maximo) maximo = o.maximo;
+    ultimo = o.ultimo;
+    n = total;
+  }
+
+  void zerar() { *this = EstatisticaIntervalo(); }
+};
+
+// ==================== PAYLOAD DO UPLINK ====================
+
+// Um intervalo fechado, pronto para envio: o que o payload usa é copiado no
+// fechamento, então a tarefa de uplink não lê estado do loop
+struct LoteEnvio {
+  EstatisticaIntervalo est;
+  uint32_t seq;
+  unsigned long criadoMs;
+  unsigned long loopMaxUs;
+  float temperaturaAr;
+  float umidadeAr;
+  float taxa;           // %/min
+  long etaMin;
+  bool ambiente;
+  bool secagem;         // Estimador confiável no fechamento
+  bool display;
+  bool bomba;
+};
+
+// "umidade" é a última leitura; o resumo cobre todas as leituras do intervalo.
+// idade_ms: quanto o lote esperou na fila (o backend data o registro por ela);
+// cfg: versão dos parâmetros de controle em uso (lida na hora do envio)
+inline size_t montarPayload(char* buf, size_t tam, const LoteEnvio& l, const char* dispositivo,
+                            unsigned long idadeMs, uint32_t cfg) {
+  const EstatisticaIntervalo& est = l.est;
+  int len = snprintf(buf, tam,
+      "{\"dispositivo\": \"%s\", \"umidade\": %.2f, \"n\": %lu, \"min\": %.2f, \"max\": %.2f, \"media\": %.2f, \"desvio\": %.3f, \"display\": %s, \"bomba\": %s, \"seq\": %lu, \"loop_max_us\": %lu, \"idade_ms\": %lu, \"cfg\": %lu",
+      dispositivo, est.ultimo, est.n, est.minimo, est.maximo, est.media, est.desvio(),
+      l.display ? "true" : "false", l.bomba ? "true" : "false",
+      (unsigned long)l.seq, l.loopMaxUs, idadeMs, (unsigned long)cfg);
+  if (l.ambiente) {
+    len += snprintf(buf + len, tam - len,
+                    ", \"temp_ar\": %.2f, \"umid_ar\": %.2f", l.temperaturaAr, l.umidadeAr);
+  }
+  if (l.secagem) {
+    // Taxa em %/h e minutos até o alvo (próxima rega)
+    len += snprintf(buf + len, tam - len,
+                    ", \"taxa\": %.2f, \"eta_min\": %ld", l.taxa * 60, l.etaMin);
+  }
+  len += snprintf(buf + len, tam - len, "}");
+  return (size_t)len < tam - 1 ? (size_t)len : tam - 1;
+}
+
+// ==================== MOTOR DE MENUS ====================
+// As telas são dados (tabela DefTela): título, linhas fixas, parte dinâmica,
+// campo numérico e mapa de teclas. Um único renderizador e um único motor de
+// teclado atendem todas; tela nova = uma entrada na tabela.
+
+enum Tela : uint8_t { TELA_PRINCIPAL, TELA_MENU_CONFIG, TELA_SETPOINT, TELA_CALIB_DRY, TELA_CALIB_WET, TELA_API_INTERVAL_CONFIG, TELA_N };
+
+struct CampoNumerico {
+  const char* rotulo;
+  uint8_t digitos;
+  long minimo;
+  long maximo;
+  void (*aplicar)(long valor);
+};
+
+struct AcaoTecla {
+  char tecla;
+  Tela destino;
+  void (*acao)();   // Executada antes da troca de tela (pode ser nullptr)
+};
+
+struct DefTela {
+  const char* titulo;       // nullptr = tela desenha tudo em desenharExtra
+  const char* linhas[3];    // Texto fixo em Y_LINHAS (nullptr = vazio)
+  const char* rodape;
+  void (*desenharExtra)();  // Parte dinâmica (pode ser nullptr)
+  const CampoNumerico* campo;
+  const AcaoTecla* teclas;
+  uint8_t nTeclas;
+};
+
+// Motor único: dígitos vão para o campo da tela; demais teclas seguem o mapa.
+// `entrada` precisa de espaço para os dígitos do maior campo + '\0'.
+inline void processarTecla(const DefTela* telas, Tela& tela, char* entrada, uint8_t& entradaLen, char k) {
+  const DefTela& def = telas[tela];
+  if (def.campo && k >= '0' && k <= '9') {
+    if (entradaLen < def.campo->digitos) {
+      entrada[entradaLen++] = k;
+      entrada[entradaLen] = '\0';
+    }
+  } else {
+    for (uint8_t i = 0; i < def.nTeclas; i++) {
+      const AcaoTecla& a = def.teclas[i];
+      if (a.tecla != k) continue;
+      if (a.acao) a.acao();
+      tela = a.destino;
+      entradaLen = 0;       // Toda troca de tela começa com o campo vazio
+      entrada[0] = '\0';
+      break;
+    }
+  }
+}
+
+// Linhas fixas e rodapé em posições padrão
+constexpr int16_t Y_TITULO = 2;
+constexpr int16_t Y_LINHAS[] = {18, 29, 40};
+constexpr int16_t Y_CAMPO = 34;
+constexpr int16_t Y_RODAPE = 55;
+constexpr uint16_t COR_TEXTO = 1;   // Pixel aceso
+
+// Renderizador único: monta a tela no framebuffer de `gfx` (qualquer alvo com a
+// API de texto do Adafruit_GFX e clearDisplay); a parte dinâmica é desenharExtra
+template <typename Gfx>
+void comporTela(Gfx& gfx, const DefTela& tela, const char* entrada) {
+  gfx.clearDisplay();
+  gfx.setTextSize(1);
+  gfx.setTextColor(COR_TEXTO);
+
+  if (tela.titulo) {
+    gfx.setCursor(4, Y_TITULO);
+    gfx.print(tela.titulo);
+  }
+  for (int i = 0; i < 3; i++) {
+    if (!tela.linhas[i]) continue;
+    gfx.setCursor(4, Y_LINHAS[i]);
+    gfx.print(tela.linhas[i]);
+  }
+  if (tela.desenharExtra) tela.desenharExtra();
+  if (tela.campo) {
+    gfx.setCursor(0, Y_CAMPO);
+    gfx.print(tela.campo->rotulo);
+    gfx.print(entrada);
+    gfx.print("_");
+  }
+  gfx.setCursor(0, Y_RODAPE);
+  gfx.print(tela.rodape);
+}
@@ -0,0 +1,116 @@
+# Coleta e compara resultados da bancada do firmware (env esp32dev_bancada).
+# O firmware imprime "BANCADA {json}" no boot e a cada 'b' pela serial.
+#
+# Uso:
+#   python scripts/bancada.py --porta /dev/ttyUSB0 --saida bancada/v1.2.json
+#   python scripts/bancada.py --log monitor.txt --saida atual.json --base bancada/v1.2.json
+#   python scripts/bancada.py --host build-bancada/bancada_host.json --saida host-base.json
+#   python scripts/bancada.py --host build-bancada/bancada_host.json --base host-base.json
+# --host lê o JSON do Google Benchmark da bancada no host (bancada/CMakeLists.txt).
+# Com --base, casos mais lentos que a tolerância (ciclos por iteração na placa,
+# ns no host) são listados e o script sai com código 1, para uso em CI/release.
+import argparse
+import json
+import sys
+import time
+
+PREFIXO = "BANCADA "
+
+def ler_serial(porta, baud, timeout_s):
+    import serial  # pyserial (vem com o PlatformIO)
+    with serial.Serial(porta, baud, timeout=1) as s:
+        s.reset_input_buffer()
+        s.write(b"b")
+        limite = time.monotonic() + timeout_s
+        while time.monotonic() < limite:
+            linha = s.readline().decode(errors="replace").strip()
+            if linha.startswith(PREFIXO):
+                return json.loads(linha[len(PREFIXO):])
+    raise SystemExit(f"Sem linha {PREFIXO.strip()} em {timeout_s} s na porta {porta}")
+
+def ler_log(caminho):
+    resultado = None
+    with open(caminho, encoding="utf-8", errors="replace") as f:
+        for linha in f:
+            i = linha.find(PREFIXO)
+            if i >= 0:
+                resultado = json.loads(linha[i + len(PREFIXO):])  # Vale a última
+    if resultado is None:
+        raise SystemExit(f"Nenhuma linha {PREFIXO.strip()} em {caminho}")
+    return resultado
+
+def ler_host(caminho):
+    """Converte o JSON do Google Benchmark para o formato da placa (mediana se houver repetições)."""
+    with open(caminho, encoding="utf-8") as f:
+        dados = json.load(f)
+    escala = {"ns": 1, "us": 1e3, "ms": 1e6, "s": 1e9}
+    casos = {}
+    for b in dados["benchmarks"]:
+        if b.get("run_type") == "aggregate" and b.get("aggregate_name") != "median":
+            continue
+        nome = b.get("run_name", b["name"])
+        casos[nome] = {"nome": nome, "iter": b["iterations"],
+                       "ns": round(b["cpu_time"] * escala[b.get("time_unit", "ns")], 3)}
+    contexto = dados.get("context", {})
+    return {"perfil": "host", "compilado": contexto.get("date"),
+            "mhz": contexto.get("mhz_per_cpu"), "casos": list(casos.values())}
+
+def formatar(valor):
+    return f"{valor:.2f}" if isinstance(valor, float) else str(valor)
+
+def comparar(atual, base, tolerancia):
+    """Imprime a tabela e devolve os casos que regrediram além da tolerância."""
+    anteriores = {c["nome"]: c for c in base["casos"]}
+    regressoes = []
+    print(f"{'caso':<14}{'base':>10}{'atual':>10}{'var':>9}")
+    for caso in atual["casos"]:
+        campo = "ciclos" if "ciclos" in caso else "ns"   # Placa: ciclos; host: ns
+        ant = anteriores.get(caso["nome"])
+        if ant is None or campo not in ant:
+            print(f"{caso['nome']:<14}{'-':>10}{formatar(caso[campo]):>10}{'novo':>9}")
+            continue
+        var = (caso[campo] - ant[campo]) / max(1e-9, ant[campo])
+        marca = " <-" if var > tolerancia else ""
+        print(f"{caso['nome']:<14}{formatar(ant[campo]):>10}{formatar(caso[campo]):>10}{var:>+8.1%}{marca}")
+        if var > tolerancia:
+            regressoes.append(caso["nome"])
+    return regressoes
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__)
+    origem = ap.add_mutually_exclusive_group(required=True)
+    origem.add_argument("--porta", help="Porta serial do ESP32")
+    origem.add_argument("--log", help="Arquivo com a saída do monitor serial")
+    origem.add_argument("--host", help="JSON do Google Benchmark (bancada no host)")
+    ap.add_argument("--baud", type=int, default=115200)
+    ap.add_argument("--timeout", type=int, default=60)
+    ap.add_argument("--saida", help="Grava o resultado (JSON)")
+    ap.add_argument("--base", help="Resultado anterior para comparar")
+    ap.add_argument("--tolerancia", type=float, default=0.10, help="Regressão aceita (fração)")
+    args = ap.parse_args()
+
+    if args.host:
+        atual = ler_host(args.host)
+    elif args.porta:
+        atual = ler_serial(args.porta, args.baud, args.timeout)
+    else:
+        atual = ler_log(args.log)
+    if args.saida:
+        with open(args.saida, "w", encoding="utf-8") as f:
+            json.dump(atual, f, indent=2)
+    if not args.base:
+        print(json.dumps(atual, indent=2))
+        return 0
+
+    with open(args.base, encoding="utf-8") as f:
+        base = json.load(f)
+    if base.get("perfil") != atual.get("perfil") or base.get("mhz") != atual.get("mhz"):
+        print(f"Aviso: base {base.get('perfil')}@{base.get('mhz')} MHz, atual {atual.get('perfil')}@{atual.get('mhz')} MHz")
+    regressoes = comparar(atual, base, args.tolerancia)
+    if regressoes:
+        print(f"Regressão acima de {args.tolerancia:.0%}: {', '.join(regressoes)}")
+        return 1
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
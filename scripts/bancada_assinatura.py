@@ -0,0 +1,44 @@
+# Custo da verificação do uplink assinado no backend, por requisição: HMAC de
+# um payload típico do nó e janela anti-replay. O lado do nó é o caso "hmac"
+# da bancada do firmware (scripts/bancada.py).
+#
+# Uso (na pasta do backend; importa o app.py):
+#   python scripts/bancada_assinatura.py --iter 20000
+import argparse
+import hashlib
+import hmac
+import json
+import os
+import sys
+import timeit
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+from app import assinatura_valida, aceitar_seq  # noqa: E402
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Mede o custo da verificação HMAC + anti-replay")
+    ap.add_argument("--iter", type=int, default=20000)
+    args = ap.parse_args()
+
+    chave = bytes(32)
+    corpo = json.dumps({"dispositivo": "esp32-BANCAD", "umidade": 41.5, "n": 15, "min": 40.9,
+                        "max": 42.0, "media": 41.4, "desvio": 0.312, "display": True,
+                        "bomba": False, "seq": 123, "loop_max_us": 5400, "idade_ms": 0}).encode()
+    mensagem = b"esp32-BANCAD\n1\n1\n0\n" + corpo
+    assinatura = hmac.new(chave, mensagem, hashlib.sha256).hexdigest()
+    seq = iter(range(1, 10 ** 9))
+
+    casos = {
+        "hmac": lambda: assinatura_valida(chave, "esp32-BANCAD", 1, 1, 0, corpo, assinatura),
+        "replay": lambda: aceitar_seq("esp32-BANCAD", chave, 1, next(seq)),
+    }
+    print(f"payload de {len(corpo)} bytes, {args.iter} iterações")
+    for nome, fn in casos.items():
+        t = timeit.timeit(fn, number=args.iter)
+        print(f"{nome:8s} {t / args.iter * 1e6:8.2f} us/requisição")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
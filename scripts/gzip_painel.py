@@ -0,0 +1,19 @@
+# Extra script do PlatformIO: gera data/index.html.gz a partir de painel/index.html.
+# O ESP32 serve o arquivo já comprimido (header Content-Encoding gzip), sem gastar CPU.
+import gzip
+import os
+
+Import("env")
+
+raiz = env["PROJECT_DIR"]
+origem = os.path.join(raiz, "painel", "index.html")
+destino = os.path.join(raiz, "data", "index.html.gz")
+
+if not os.path.exists(destino) or os.path.getmtime(destino) < os.path.getmtime(origem):
+    os.makedirs(os.path.dirname(destino), exist_ok=True)
+    with open(origem, "rb") as f:
+        dados = f.read()
+    comprimido = gzip.compress(dados, compresslevel=9, mtime=0)
+    with open(destino, "wb") as f:
+        f.write(comprimido)
+    print(f"Dashboard local: {len(dados)} -> {len(comprimido)} bytes (gzip)")
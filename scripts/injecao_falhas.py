@@ -0,0 +1,241 @@
+# Servidor falso do FastAPI para testar o uplink do ESP32 sob falhas de rede.
+# Atende POST /api/umidade/registrar (e /api/captura) trocando de perfil de
+# falha a cada --duracao segundos e, ao final, mede por perfil:
+#   - latência do loop de controle (loop_max_us enviado pelo nó)
+#   - perda de dados (leituras "n" armazenadas vs. esperadas pelo tempo)
+#   - lotes que não chegaram (lacunas em "seq") e espaçamento das retentativas
+#
+# Uso (firmware do env esp32dev_falhas apontando para esta máquina):
+#   python scripts/injecao_falhas.py --porta 8090 --duracao 300 --relatorio falhas.json
+#   python scripts/injecao_falhas.py --perfis '[{"nome":"lento","latencia":[2,6]}]'
+#
+# Perfil: {"nome", "acao": ok|queda|reset|recusa|codigo, "latencia": [min,max] s,
+#          "codigo": http, "retry_after": s, "prob": fração das requisições afetadas}
+import argparse
+import json
+import random
+import socket
+import struct
+import sys
+import threading
+import time
+
+PERFIS_PADRAO = [
+    {"nome": "normal", "acao": "ok"},
+    {"nome": "lento", "acao": "ok", "latencia": [2, 8]},
+    {"nome": "muito_lento", "acao": "ok", "latencia": [15, 25]},  # Além do prazo de resposta do nó
+    {"nome": "queda", "acao": "queda"},                           # Lê o pedido e nunca responde
+    {"nome": "reset", "acao": "reset"},                           # RST logo após o pedido
+    {"nome": "recusa", "acao": "recusa"},                         # Porta fechada
+    {"nome": "erro500", "acao": "codigo", "codigo": 500},
+    {"nome": "sobrecarga", "acao": "codigo", "codigo": 503, "retry_after": 30},
+    {"nome": "instavel", "acao": "reset", "prob": 0.3},
+]
+
+# Ações em que o backend real teria gravado o registro
+ARMAZENA = {"ok", "queda"}
+
+
+class Injetor:
+    def __init__(self, perfis, duracao, porta, intervalo_sensor):
+        self.perfis = perfis
+        self.duracao = duracao
+        self.porta = porta
+        self.intervalo_sensor = intervalo_sensor
+        self.inicio = time.monotonic()
+        self.trava = threading.Lock()
+        self.eventos = []   # Uma entrada por requisição recebida
+        self.escuta = None
+
+    def perfil_atual(self):
+        i = int((time.monotonic() - self.inicio) // self.duracao)
+        return (i, self.perfis[i]) if i < len(self.perfis) else (i, None)
+
+    # --- Servidor ---
+
+    def abrir(self):
+        s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        s.bind(("", self.porta))
+        s.listen(16)
+        s.settimeout(0.5)
+        self.escuta = s
+
+    def fechar(self):
+        if self.escuta:
+            self.escuta.close()
+            self.escuta = None
+
+    def rodar(self):
+        print(f"Injetor de falhas em :{self.porta}, {len(self.perfis)} perfis x {self.duracao} s")
+        ultimo = -1
+        while True:
+            i, perfil = self.perfil_atual()
+            if perfil is None:
+                self.fechar()
+                return
+            if i != ultimo:
+                ultimo = i
+                print(f"[{self.decorrido():7.1f}s] perfil: {perfil['nome']}", flush=True)
+            # "recusa": porta fechada durante o perfil inteiro
+            if perfil.get("acao") == "recusa" and perfil.get("prob", 1) >= 1:
+                self.fechar()
+                time.sleep(0.5)
+                continue
+            if self.escuta is None:
+                self.abrir()
+            try:
+                conn, _ = self.escuta.accept()
+            except socket.timeout:
+                continue
+            threading.Thread(target=self.atender, args=(conn, i, perfil), daemon=True).start()
+
+    def decorrido(self):
+        return time.monotonic() - self.inicio
+
+    def ler_pedido(self, conn, dados):
+        """Lê um pedido de `dados` + socket; devolve (linha, corpo, sobra).
+
+        O nó manda até 4 POSTs em pipeline na mesma conexão: o corpo é cortado
+        no Content-Length e o que vier depois é o início do próximo pedido.
+        """
+        while b"\r\n\r\n" not in dados:
+            parte = conn.recv(4096)
+            if not parte:
+                return None, None, b""
+            dados += parte
+        cabeca, resto = dados.split(b"\r\n\r\n", 1)
+        linhas = cabeca.decode(errors="replace").split("\r\n")
+        tamanho = 0
+        for linha in linhas[1:]:
+            nome, _, valor = linha.partition(":")
+            if nome.strip().lower() == "content-length":
+                tamanho = int(valor.strip())
+        while len(resto) < tamanho:
+            parte = conn.recv(4096)
+            if not parte:
+                break
+            resto += parte
+        return linhas[0], resto[:tamanho], resto[tamanho:]
+
+    def atender(self, conn, indice, perfil):
+        conn.settimeout(10)
+        sobra = b""
+        mudo = False   # Depois de uma "queda" nada mais é respondido nesta conexão
+        try:
+            # Um pedido por volta, na ordem; a conexão segue aberta até o nó fechar
+            while True:
+                linha, corpo, sobra = self.ler_pedido(conn, sobra)
+                if linha is None:
+                    return
+                acao = self.responder(conn, linha, corpo, indice, perfil, "queda" if mudo else None)
+                if acao == "reset":
+                    return
+                mudo = mudo or acao in ("queda", "recusa")
+        except OSError:
+            pass
+        finally:
+            conn.close()
+
+    def responder(self, conn, linha, corpo, indice, perfil, forcar=None):
+        """Registra um pedido e aplica o perfil a ele; devolve a ação aplicada."""
+        chegada = self.decorrido()
+        acao = forcar or perfil.get("acao", "ok")
+        if not forcar and random.random() >= perfil.get("prob", 1):
+            acao = "ok"   # Requisição não afetada neste perfil
+        atraso = random.uniform(*perfil["latencia"]) if "latencia" in perfil else 0
+
+        if "/api/umidade/registrar" in linha:
+            try:
+                payload = json.loads(corpo or b"{}")
+            except ValueError:
+                payload = {}
+            with self.trava:
+                self.eventos.append({
+                    "t": round(chegada, 3), "perfil": indice, "acao": acao,
+                    "seq": payload.get("seq"), "n": payload.get("n", 1),
+                    "loop_max_us": payload.get("loop_max_us"), "atraso": round(atraso, 2),
+                })
+
+        if acao == "reset":
+            # SO_LINGER 0: close() manda RST em vez de FIN
+            conn.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER, struct.pack("ii", 1, 0))
+            return acao
+        if acao in ("queda", "recusa"):
+            return acao   # Lido (e "gravado"), nunca respondido: o nó estoura o prazo
+        time.sleep(atraso)
+        codigo = perfil.get("codigo", 200) if acao == "codigo" else 200
+        corpo_resp = b'{"status":"OK"}' if codigo == 200 else b'{"detail":"falha injetada"}'
+        extra = f"Retry-After: {perfil['retry_after']}\r\n" if "retry_after" in perfil and acao == "codigo" else ""
+        conn.sendall((f"HTTP/1.1 {codigo} X\r\nContent-Type: application/json\r\n"
+                      f"Content-Length: {len(corpo_resp)}\r\n{extra}\r\n").encode() + corpo_resp)
+        return acao
+
+    # --- Relatório ---
+
+    def relatorio(self):
+        resumo = []
+        ultimo_seq = None
+        for i, perfil in enumerate(self.perfis):
+            evs = sorted((e for e in self.eventos if e["perfil"] == i), key=lambda e: e["t"])
+            # Lacunas: lotes numerados pelo nó que nunca chegaram aqui (fundidos com
+            # a fila cheia; contados no perfil em que o nó volta a chegar, ex.: o
+            # seguinte a "recusa"). Reenvios fora de ordem não contam como lacuna.
+            lacunas = 0
+            for e in evs:
+                if e["seq"] is not None and ultimo_seq is not None and e["seq"] > ultimo_seq + 1:
+                    lacunas += e["seq"] - ultimo_seq - 1
+                if e["seq"] is not None:
+                    ultimo_seq = max(e["seq"], ultimo_seq or 0)
+            loops = sorted(e["loop_max_us"] for e in evs if e["loop_max_us"] is not None)
+            chegadas = [e["t"] for e in evs]
+            espacos = [b - a for a, b in zip(chegadas, chegadas[1:])]
+            armazenadas = sum(e["n"] or 0 for e in evs if e["acao"] in ARMAZENA)
+            esperadas = self.duracao / self.intervalo_sensor
+            resumo.append({
+                "perfil": perfil["nome"],
+                "requisicoes": len(evs),
+                "aceitas": sum(1 for e in evs if e["acao"] == "ok"),
+                "tentativas_perdidas": lacunas,
+                "leituras_armazenadas": armazenadas,
+                "leituras_esperadas": round(esperadas),
+                # Negativa = duplicação (o nó reenviou algo que já estava gravado)
+                "perda": round(1 - armazenadas / esperadas, 3) if esperadas else None,
+                "loop_max_us": loops[-1] if loops else None,
+                "loop_p95_us": loops[int(0.95 * (len(loops) - 1))] if loops else None,
+                "espaco_medio_s": round(sum(espacos) / len(espacos), 1) if espacos else None,
+                "espaco_max_s": round(max(espacos), 1) if espacos else None,
+            })
+        return resumo
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Servidor falso com injeção de falhas para o uplink do ESP32")
+    ap.add_argument("--porta", type=int, default=8090)
+    ap.add_argument("--duracao", type=float, default=300, help="Segundos por perfil")
+    ap.add_argument("--perfis", help="Lista JSON de perfis (padrão: todos os embutidos)")
+    ap.add_argument("--intervalo-sensor", type=float, default=2.0, help="Intervalo de leitura do nó (s)")
+    ap.add_argument("--relatorio", help="Grava o relatório (JSON)")
+    args = ap.parse_args()
+
+    perfis = json.loads(args.perfis) if args.perfis else PERFIS_PADRAO
+    injetor = Injetor(perfis, args.duracao, args.porta, args.intervalo_sensor)
+    try:
+        injetor.rodar()
+    except KeyboardInterrupt:
+        pass
+    resumo = injetor.relatorio()
+
+    print(f"\n{'perfil':<13}{'req':>5}{'ok':>5}{'lacunas':>8}{'perda':>8}{'loop max':>11}{'p95':>9}{'espaço':>8}")
+    for r in resumo:
+        perda = f"{r['perda']:+.1%}" if r["perda"] is not None else "-"
+        print(f"{r['perfil']:<13}{r['requisicoes']:>5}{r['aceitas']:>5}{r['tentativas_perdidas']:>8}{perda:>8}"
+              f"{r['loop_max_us'] or '-':>11}{r['loop_p95_us'] or '-':>9}{r['espaco_medio_s'] or '-':>8}")
+    if args.relatorio:
+        with open(args.relatorio, "w", encoding="utf-8") as f:
+            json.dump({"perfis": perfis, "resumo": resumo, "eventos": injetor.eventos}, f, indent=2)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
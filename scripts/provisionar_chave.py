@@ -0,0 +1,79 @@
+# Provisiona a chave HMAC do uplink de um nó: gera 32 bytes aleatórios, grava
+# na coleção chaves_dispositivo do backend e monta a partição NVS do ESP32
+# (namespace "uplink", chave "hmac") para gravar com o esptool.
+#
+# Uso:
+#   python scripts/provisionar_chave.py --dispositivo esp32-A1B2C3 --csv nvs_chave.csv
+#   python scripts/provisionar_chave.py --dispositivo esp32-A1B2C3 --porta /dev/ttyUSB0
+#
+# Com --porta a partição NVS inteira é regravada (offset/tamanho da tabela de
+# partições padrão do Arduino): credenciais WiFi salvas e o contador de boots
+# somem; o backend zera a janela anti-replay ao ver a chave nova. Para a chave
+# não ficar legível na flash, habilite a criptografia da NVS/flash no nó.
+import argparse
+import os
+import secrets
+import subprocess
+import sys
+import tempfile
+
+NVS_OFFSET = "0x9000"
+NVS_TAMANHO = "0x5000"
+
+
+def escrever_csv(caminho, chave_hex):
+    with open(caminho, "w", encoding="utf-8") as f:
+        f.write("key,type,encoding,value\n")
+        f.write("uplink,namespace,,\n")
+        f.write(f"hmac,data,hex2bin,{chave_hex}\n")
+
+
+def gravar_no_no(csv_path, porta):
+    with tempfile.TemporaryDirectory() as tmp:
+        binario = os.path.join(tmp, "nvs.bin")
+        subprocess.run([sys.executable, "-m", "esp_idf_nvs_partition_gen", "generate",
+                        csv_path, binario, NVS_TAMANHO], check=True)
+        subprocess.run([sys.executable, "-m", "esptool", "--port", porta,
+                        "write_flash", NVS_OFFSET, binario], check=True)
+
+
+def registrar_no_backend(uri, banco, dispositivo, chave_hex):
+    from pymongo import MongoClient
+    client = MongoClient(uri, serverSelectionTimeoutMS=5000)
+    client[banco]["chaves_dispositivo"].replace_one(
+        {"_id": dispositivo}, {"_id": dispositivo, "chave": chave_hex}, upsert=True)
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Provisiona a chave HMAC do uplink de um nó")
+    ap.add_argument("--dispositivo", required=True, help="ID do nó (esp32-XXXXXX, impresso no boot)")
+    ap.add_argument("--chave", help="Chave em hex (64 dígitos); padrão: gera uma nova")
+    ap.add_argument("--csv", help="Grava o CSV da partição NVS (nvs_partition_gen)")
+    ap.add_argument("--porta", help="Gera a partição e grava no nó por esta porta serial")
+    ap.add_argument("--mongo", default=os.getenv("MONGO_URI", "mongodb://localhost:27017"))
+    ap.add_argument("--db", default=os.getenv("DB_NAME", "irrigacao_db"))
+    ap.add_argument("--sem-backend", action="store_true", help="Não grava a chave no MongoDB")
+    args = ap.parse_args()
+
+    chave_hex = (args.chave or secrets.token_hex(32)).lower()
+    if len(bytes.fromhex(chave_hex)) != 32:
+        raise SystemExit("A chave precisa ter 32 bytes (64 dígitos hex)")
+
+    if not args.sem_backend:
+        registrar_no_backend(args.mongo, args.db, args.dispositivo, chave_hex)
+        print(f"Chave de {args.dispositivo} registrada em {args.db}.chaves_dispositivo")
+
+    csv_path = args.csv
+    if args.porta and not csv_path:
+        csv_path = os.path.join(tempfile.mkdtemp(), "nvs_chave.csv")
+    if csv_path:
+        escrever_csv(csv_path, chave_hex)
+        print(f"CSV da NVS em {csv_path}")
+    if args.porta:
+        gravar_no_no(csv_path, args.porta)
+        print(f"Partição NVS gravada em {args.porta} ({NVS_OFFSET})")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,25 @@
+# Receptor local de alertas para testes: imprime cada evento recebido por POST.
+# Uso: python scripts/receptor_alertas.py [porta]
+#      ALERTAS_WEBHOOK_URL=http://localhost:9000/ uvicorn app:app
+import json
+import sys
+from http.server import BaseHTTPRequestHandler, HTTPServer
+
+class Receptor(BaseHTTPRequestHandler):
+    def do_POST(self):
+        corpo = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+        try:
+            evento = json.loads(corpo)
+            print(f"[{evento['estado']}] {evento['regra']} @ {evento['dispositivo']}: {evento['detalhe']}", flush=True)
+        except (ValueError, KeyError):
+            print(f"Corpo inesperado: {corpo!r}", flush=True)
+        self.send_response(204)
+        self.end_headers()
+
+    def log_message(self, *args):
+        pass
+
+if __name__ == "__main__":
+    porta = int(sys.argv[1]) if len(sys.argv) > 1 else 9000
+    print(f"Receptor de alertas em http://localhost:{porta}/")
+    HTTPServer(("", porta), Receptor).serve_forever()
@@ -0,0 +1,88 @@
+# Extra script do PlatformIO: relatório de RAM/flash estáticas por módulo e
+# orçamento por perfil. Lê o map do linker depois do link e falha o build se
+# custom_orcamento_ram / custom_orcamento_flash do [env] forem ultrapassados.
+import os
+import re
+from collections import defaultdict
+
+Import("env")
+
+MAPA = os.path.join(env.subst("$BUILD_DIR"), "firmware.map")
+env.Append(LINKFLAGS=["-Wl,-Map=" + MAPA])
+
+# Seções de saída do ESP32 e onde ocupam espaço (DRAM estática / imagem na flash)
+SECOES_RAM = (".dram0.data", ".dram0.bss", ".noinit")
+SECOES_FLASH = (".flash.text", ".flash.rodata", ".iram0.text", ".iram0.vectors", ".dram0.data")
+
+RE_ENTRADA = re.compile(r"^\s+(?:\S+\s+)?0x[0-9a-f]+\s+0x([0-9a-f]+)\s+(\S.*)$")
+
+
+def nome_modulo(objeto):
+    """libfoo.a(bar.o) -> libfoo.a; .pio/build/x/src/esp32.cpp.o -> esp32.cpp"""
+    m = re.match(r"(.*?)\(.*\)$", objeto)
+    base = os.path.basename(m.group(1) if m else objeto)
+    return base[:-2] if base.endswith(".o") else base
+
+
+def ler_mapa(caminho):
+    """Soma por módulo os bytes das seções de entrada de cada seção de saída."""
+    ram = defaultdict(int)
+    flash = defaultdict(int)
+    secao = None
+    dentro = False
+    with open(caminho, errors="replace") as f:
+        for linha in f:
+            if linha.startswith("Linker script and memory map"):
+                dentro = True
+                continue
+            if not dentro:
+                continue
+            if linha.startswith("."):
+                secao = linha.split()[0]
+                continue
+            m = RE_ENTRADA.match(linha)
+            if not m or secao is None:
+                continue
+            tamanho = int(m.group(1), 16)
+            if tamanho == 0:
+                continue
+            modulo = nome_modulo(m.group(2).strip())
+            if secao in SECOES_RAM:
+                ram[modulo] += tamanho
+            if secao in SECOES_FLASH:
+                flash[modulo] += tamanho
+    return ram, flash
+
+
+def orcamento(opcao):
+    valor = env.GetProjectOption(opcao, "")
+    return int(valor) if valor else None
+
+
+def relatorio(target, source, env):
+    if not os.path.exists(MAPA):
+        print("Relatorio de memoria: map do linker nao encontrado")
+        return
+    ram, flash = ler_mapa(MAPA)
+    total_ram = sum(ram.values())
+    total_flash = sum(flash.values())
+
+    print(f"=== Memoria por modulo ({env['PIOENV']}) ===")
+    print(f"{'modulo':40s} {'RAM':>9s} {'flash':>9s}")
+    modulos = sorted(set(ram) | set(flash), key=lambda m: -(ram[m] + flash[m]))
+    for m in modulos[:25]:
+        print(f"{m[:40]:40s} {ram[m]:9d} {flash[m]:9d}")
+    print(f"{'TOTAL':40s} {total_ram:9d} {total_flash:9d}")
+
+    estouros = []
+    for nome, total, opcao in (("RAM", total_ram, "custom_orcamento_ram"),
+                               ("flash", total_flash, "custom_orcamento_flash")):
+        limite = orcamento(opcao)
+        if limite is not None and total > limite:
+            estouros.append(f"{nome}: {total} > {limite} bytes ({opcao})")
+    if estouros:
+        print("ORCAMENTO DE MEMORIA ESTOURADO: " + "; ".join(estouros))
+        env.Exit(1)
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", relatorio)